@@ -17,6 +17,7 @@
 #include "esp_check.h"
 
 #include "avifile.h"
+#include "avi_reader.h"
 #include "avi_player.h"
 
 static const char *TAG = "avi player";
@@ -28,8 +29,13 @@ static const char *TAG = "avi player";
 #define EVENT_DEINIT_DONE     ((1 << 4))
 #define EVENT_VIDEO_BUF_READY ((1 << 5))
 #define EVENT_AUDIO_BUF_READY ((1 << 6))
+#define EVENT_SEEK            ((1 << 7))
+#define EVENT_PLAY_PREPARED   ((1 << 8))
 
-#define EVENT_ALL          (EVENT_FPS_TIME_UP | EVENT_START_PLAY | EVENT_STOP_PLAY | EVENT_DEINIT)
+#define AV_SYNC_EARLY_US      (2 * 1000)  /*!< a video frame this close to its presentation time is shown right away */
+#define BUFFER_MIN_SIZE       (16 * 1024) /*!< smallest internal buffer, the index is loaded in blocks of this size */
+
+#define EVENT_ALL          (EVENT_FPS_TIME_UP | EVENT_START_PLAY | EVENT_STOP_PLAY | EVENT_DEINIT | EVENT_SEEK | EVENT_PLAY_PREPARED)
 
 typedef enum {
     PLAY_FILE,
@@ -39,6 +45,7 @@ typedef enum {
 typedef enum {
     AVI_PARSER_NONE,
     AVI_PARSER_HEADER,
+    AVI_PARSER_READY,            /*!< header parsed and data pre-buffered, waiting for avi_player_play_prepared() */
     AVI_PARSER_DATA,
     AVI_PARSER_END,
 } avi_play_state_t;
@@ -53,22 +60,42 @@ typedef struct {
         } memory;
         struct {
             int avi_file;
+            uint64_t read_offset;
+            avi_reader_handle_t reader; /*!< Read-ahead of the movi data, NULL to read inline */
         } file;
     };
-    uint8_t *pbuffer;
+    uint8_t *pbuffer;            /*!< Allocated on demand, kept for the next files */
+    uint32_t pbuffer_size;
     uint32_t str_size;
+    uint64_t riff_end;           /*!< End of the current RIFF, where an OpenDML "AVIX" RIFF may follow */
+    uint32_t vids_cursor;        /*!< Next video entry of the frame table to play */
+    uint32_t auds_cursor;        /*!< Next audio entry of the frame table to play */
+    int64_t seek_pts_us;         /*!< Pending seek target */
+    AVI_CHUNK_HEAD pending;      /*!< Chunk whose header was read but which is not due yet */
+    uint32_t pending_start;      /*!< Stream position of the pending chunk */
+    bool has_pending;
+    uint32_t vids_next;          /*!< Stream position of the next video chunk when walking without index */
+    uint32_t auds_next;          /*!< Stream position of the next audio chunk when walking without index */
+    int64_t clock_base_pts;      /*!< Wall clock anchor: presentation time at clock_base_time */
+    int64_t clock_base_time;
+    int64_t audio_end_pts;       /*!< End of the last audio chunk handed to audio_cb, -1 if none since start or seek */
+    int64_t audio_drain_time;    /*!< Time the audio output was found empty, -1 while it plays */
+    int64_t clock_sample_pts;    /*!< Last clock value computed by the player task, read by avi_player_get_clock() */
+    int64_t clock_sample_time;
+    avi_player_stats_t stats;
     avi_play_state_t state;
+    bool autoplay;               /*!< start playing as soon as the header is parsed */
     avi_typedef AVI_file;
 } avi_data_t;
 
-typedef struct {
+struct avi_player_t {
     EventGroupHandle_t event_group;
     esp_timer_handle_t timer_handle;
+    portMUX_TYPE clock_lock;
+    portMUX_TYPE state_lock;     /*!< taken by the API calls that move the player out of AVI_PARSER_NONE */
     avi_player_config_t config;
     avi_data_t avi_data;
-} avi_player_handle_t;
-
-static avi_player_handle_t *s_avi = NULL;
+};
 
 static uint32_t _REV(uint32_t value)
 {
@@ -76,155 +103,585 @@ static uint32_t _REV(uint32_t value)
            (value & 0x00FF0000U) >> 8 | (value & 0xFF000000U) >> 24;
 }
 
-static uint32_t read_frame(avi_data_t *avi, uint8_t *buffer, uint32_t length, uint32_t *fourcc)
+static uint64_t get_read_offset(avi_data_t *avi)
 {
-    AVI_CHUNK_HEAD head;
+    return avi->mode == PLAY_MEMORY ? avi->memory.read_offset : avi->file.read_offset;
+}
+
+static bool set_read_offset(avi_data_t *avi, uint64_t offset)
+{
+    if (avi->mode == PLAY_MEMORY) {
+        if (offset > avi->memory.size) {
+            return false;
+        }
+        avi->memory.read_offset = offset;
+    } else if (avi->mode == PLAY_FILE) {
+        if (avi->file.reader) {
+            avi_reader_seek(avi->file.reader, offset);
+        } else if (!avi_lseek64(avi->file.avi_file, offset)) {
+            return false;
+        }
+        avi->file.read_offset = offset;
+    }
+    return true;
+}
 
+static bool read_data(avi_data_t *avi, void *buffer, uint32_t size)
+{
     if (avi->mode == PLAY_MEMORY) {
-        if (sizeof(AVI_CHUNK_HEAD) > (avi->memory.size - avi->memory.read_offset)) {
-            ESP_LOGE(TAG, "not enough data for chunk head");
-            return 0;
+        if (avi->memory.read_offset > avi->memory.size || size > avi->memory.size - avi->memory.read_offset) {
+            return false;
         }
-        memcpy(&head, avi->memory.data + avi->memory.read_offset, sizeof(AVI_CHUNK_HEAD));
-        avi->memory.read_offset += sizeof(AVI_CHUNK_HEAD);
+        memcpy(buffer, avi->memory.data + avi->memory.read_offset, size);
+        avi->memory.read_offset += size;
     } else if (avi->mode == PLAY_FILE) {
-        read(avi->file.avi_file, &head, sizeof(AVI_CHUNK_HEAD));
+        ssize_t ret;
+        if (avi->file.reader) {
+            ret = (ssize_t)avi_reader_read(avi->file.reader, buffer, size);
+        } else {
+            int64_t start = esp_timer_get_time();
+            ret = read(avi->file.avi_file, buffer, size);
+            if (ret > 0) {
+                avi->stats.storage_bytes += ret;
+                avi->stats.storage_time_us += esp_timer_get_time() - start;
+            }
+        }
+        if (ret > 0) {
+            avi->file.read_offset += ret;
+        }
+        if (ret != (ssize_t)size) {
+            return false;
+        }
     }
+    return true;
+}
 
-    if (head.FourCC) {
-        /* handle FourCC if needed */
+static bool read_chunk_head(avi_data_t *avi, AVI_CHUNK_HEAD *head)
+{
+    if (!read_data(avi, head, sizeof(AVI_CHUNK_HEAD))) {
+        ESP_LOGE(TAG, "not enough data for chunk head");
+        return false;
     }
-    *fourcc = head.FourCC;
 
-    if (head.size % 2) {
-        head.size++;    /*!< add a byte if size is odd */
+    if (head->size % 2) {
+        head->size++;    /*!< add a byte if size is odd */
     }
+    return true;
+}
 
-    if (avi->mode == PLAY_MEMORY) {
-        if (head.size > (avi->memory.size - avi->memory.read_offset) || length < head.size) {
-            ESP_LOGE(TAG, "frame size %"PRIu32" exceeds available data", head.size);
-            return 0;
+/*!< false when the chunk runs past the end of the data or the seek fails, the position is then unchanged */
+static bool skip_chunk_data(avi_data_t *avi, uint32_t size)
+{
+    if (!set_read_offset(avi, get_read_offset(avi) + size)) {
+        ESP_LOGE(TAG, "cannot skip %"PRIu32" bytes at %"PRIu64"", size, get_read_offset(avi));
+        return false;
+    }
+    return true;
+}
+
+/*!< a chunk could not be skipped: end the file like after its last chunk */
+static esp_err_t end_at_bad_chunk(avi_player_handle_t handle)
+{
+    handle->avi_data.state = AVI_PARSER_END;
+    xEventGroupSetBits(handle->event_group, EVENT_STOP_PLAY);
+    return ESP_OK;
+}
+
+static uint32_t read_chunk_data(avi_data_t *avi, uint8_t *buffer, uint32_t length, uint32_t size)
+{
+    if (length < size) {
+        ESP_LOGE(TAG, "frame size %"PRIu32" exceeds available data", size);
+        skip_chunk_data(avi, size);
+        return 0;
+    }
+    bool ok = read_data(avi, buffer, size);
+    if (avi->mode == PLAY_FILE && avi->file.reader) {
+        /*!< copied here by the player task, the reader is deleted by it at the end of the file */
+        avi_reader_get_stats(avi->file.reader, &avi->stats.storage_bytes, &avi->stats.storage_time_us);
+    }
+    if (!ok) {
+        ESP_LOGE(TAG, "frame size %"PRIu32" exceeds available data", size);
+        return 0;
+    }
+    avi->stats.bytes_read += size;
+    return size;
+}
+
+static bool read_at(avi_data_t *avi, uint64_t offset, void *buffer, uint32_t size)
+{
+    return set_read_offset(avi, offset) && read_data(avi, buffer, size);
+}
+
+/**
+ * @brief Make the internal buffer hold at least `size` bytes, up to the configured buffer_size.
+ *
+ * The buffer only grows, so a buffer sized for one file is reused by the next ones.
+ */
+static bool reserve_buffer(avi_player_handle_t handle, uint32_t size)
+{
+    avi_data_t *avi = &handle->avi_data;
+    uint32_t max_size = handle->config.buffer_size;
+    size = size < max_size ? size : max_size;
+    size = size < BUFFER_MIN_SIZE ? BUFFER_MIN_SIZE : (size + BUFFER_MIN_SIZE - 1) & ~(BUFFER_MIN_SIZE - 1);
+    size = size < max_size ? size : max_size;
+    if (size <= avi->pbuffer_size) {
+        return true;
+    }
+    uint8_t *buffer = malloc(size);
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "Cannot alloc %"PRIu32" bytes for the buffer", size);
+        return avi->pbuffer != NULL;
+    }
+    ESP_LOGD(TAG, "buffer %"PRIu32" -> %"PRIu32" bytes", avi->pbuffer_size, size);
+    free(avi->pbuffer);
+    avi->pbuffer = buffer;
+    avi->pbuffer_size = size;
+    return true;
+}
+
+/**
+ * @brief Size of the internal buffer needed to play the parsed file.
+ *
+ * The largest chunk of the index is exact, the strh and avih hints are used without index,
+ * and buffer_size when the file gives no hint at all.
+ */
+static uint32_t stream_buffer_size(avi_player_handle_t handle)
+{
+    const avi_typedef *AVI_file = &handle->avi_data.AVI_file;
+    uint32_t auds = AVI_file->auds_max_chunk ? AVI_file->auds_max_chunk : AVI_file->auds_suggest_buff_size;
+    uint32_t vids = AVI_file->vids_max_chunk ? AVI_file->vids_max_chunk : AVI_file->vids_suggest_buff_size;
+    if (handle->config.video_buffer_cb) {
+        vids = 0;    /*!< video frames are read into the caller buffers */
+    }
+    uint32_t size = auds > vids ? auds : vids;
+    if (size == 0 && !handle->config.video_buffer_cb) {
+        size = AVI_file->suggest_buff_size;
+    }
+    return size ? size : handle->config.buffer_size;
+}
+
+static bool parser_read(void *ctx, uint64_t offset, void *buffer, uint32_t size)
+{
+    return read_at((avi_data_t *)ctx, offset, buffer, size);
+}
+
+static void load_std_index(avi_data_t *avi, const avi_super_index_t *super, uint8_t *buffer, uint32_t buffer_size)
+{
+    for (uint32_t i = 0; i < super->count; i++) {
+        AVI_INDEX_HEAD head;
+        uint64_t offset = super->entries[i].offset;
+        if (!read_at(avi, offset, &head, sizeof(AVI_INDEX_HEAD)) || (head.FourCC & 0x0000FFFF) != IX_ID ||
+                head.index_type != AVI_INDEX_OF_CHUNKS || head.longs_per_entry != 2) {
+            ESP_LOGW(TAG, "invalid standard index at %"PRIu64"", offset);
+            continue;
         }
-        memcpy(buffer, avi->memory.data + avi->memory.read_offset, head.size);
-        avi->memory.read_offset += head.size;
-    } else if (avi->mode == PLAY_FILE) {
-        if (length < head.size) {
-            ESP_LOGE(TAG, "frame size %"PRIu32" exceeds available data", head.size);
-            return 0;
+        /*!< read the entries in blocks that fit the internal buffer */
+        uint32_t remaining = head.entries_in_use;
+        uint32_t block = buffer_size / sizeof(AVI_STDINDEX_ENTRY);
+        while (remaining > 0) {
+            uint32_t count = remaining < block ? remaining : block;
+            if (!read_data(avi, buffer, count * sizeof(AVI_STDINDEX_ENTRY))) {
+                ESP_LOGW(TAG, "standard index truncated");
+                break;
+            }
+            avi_ix_append(&avi->AVI_file, &head, (const AVI_STDINDEX_ENTRY *)buffer, count);
+            remaining -= count;
         }
-        read(avi->file.avi_file, buffer, head.size);
     }
+}
 
-    return head.size;
+static void load_idx1(avi_data_t *avi, uint8_t *buffer, uint32_t buffer_size)
+{
+    AVI_CHUNK_HEAD head;
+    if (!read_at(avi, avi_idx1_offset(&avi->AVI_file), &head, sizeof(AVI_CHUNK_HEAD)) || head.FourCC != IDX1_ID) {
+        return;
+    }
+    /*!< read the index in blocks that fit the internal buffer */
+    uint32_t remaining = head.size / sizeof(AVI_IDX1);
+    uint32_t block = buffer_size / sizeof(AVI_IDX1);
+    while (remaining > 0) {
+        uint32_t count = remaining < block ? remaining : block;
+        if (!read_data(avi, buffer, count * sizeof(AVI_IDX1))) {
+            ESP_LOGW(TAG, "index truncated");
+            break;
+        }
+        avi_idx1_append(&avi->AVI_file, (const AVI_IDX1 *)buffer, count);
+        remaining -= count;
+    }
 }
 
-static esp_err_t avi_player(void)
+static void load_index(avi_data_t *avi, uint8_t *buffer, uint32_t buffer_size)
 {
-    static size_t BytesRD;
-    static uint32_t Strtype;
-    uint32_t buffer_size = s_avi->config.buffer_size;
-    int ret;
+    avi_typedef *AVI_file = &avi->AVI_file;
+    if (avi_index_begin(AVI_file) != 0) {
+        return;
+    }
+    /*!< prefer the OpenDML indexes, they also cover the "AVIX" RIFFs that idx1 cannot address */
+    if (AVI_file->vids_super.count > 0 || AVI_file->auds_super.count > 0) {
+        load_std_index(avi, &AVI_file->vids_super, buffer, buffer_size);
+        load_std_index(avi, &AVI_file->auds_super, buffer, buffer_size);
+    }
+    if (AVI_file->vids_index.count == 0 && AVI_file->auds_index.count == 0) {
+        load_idx1(avi, buffer, buffer_size);
+    }
+    avi_index_end(AVI_file);
+    if (AVI_file->vids_index.count == 0 && AVI_file->auds_index.count == 0) {
+        ESP_LOGW(TAG, "no index found, seeking is disabled");
+    }
+}
 
-    switch (s_avi->avi_data.state) {
-    case AVI_PARSER_HEADER: {
-        if (s_avi->avi_data.mode == PLAY_MEMORY) {
-            memcpy(s_avi->avi_data.pbuffer, s_avi->avi_data.memory.data, buffer_size);
-            BytesRD = buffer_size;
-        } else {
-            BytesRD = read(s_avi->avi_data.file.avi_file, s_avi->avi_data.pbuffer, buffer_size);
+static bool next_indexed_chunk(avi_data_t *avi, uint64_t *offset, uint32_t *start)
+{
+    const avi_index_t *vids = &avi->AVI_file.vids_index;
+    const avi_index_t *auds = &avi->AVI_file.auds_index;
+    bool has_vids = avi->vids_cursor < vids->count;
+    bool has_auds = avi->auds_cursor < auds->count;
+
+    /*!< merge both frame tables in file order */
+    if (has_vids && (!has_auds || vids->entries[avi->vids_cursor].offset < auds->entries[avi->auds_cursor].offset)) {
+        *start = vids->entries[avi->vids_cursor].start;
+        *offset = vids->entries[avi->vids_cursor++].offset;
+    } else if (has_auds) {
+        *start = auds->entries[avi->auds_cursor].start;
+        *offset = auds->entries[avi->auds_cursor++].offset;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool next_riff_movi(avi_data_t *avi)
+{
+    AVI_LIST_HEAD riff, movi;
+    uint64_t offset = avi->riff_end;
+
+    if (!read_at(avi, offset, &riff, sizeof(AVI_LIST_HEAD)) || riff.List != RIFF_ID || riff.FourCC != AVIX_ID ||
+            !read_data(avi, &movi, sizeof(AVI_LIST_HEAD)) || movi.List != LIST_ID || movi.FourCC != MOVI_ID) {
+        return false;
+    }
+    avi->AVI_file.movi_start = offset + 2 * sizeof(AVI_LIST_HEAD);
+    avi->AVI_file.movi_size = movi.size;
+    avi->riff_end = offset + sizeof(AVI_CHUNK_HEAD) + riff.size + (riff.size % 2);
+    ESP_LOGI(TAG, "AVIX movi pos:%"PRIu64", size:%"PRIu32"", avi->AVI_file.movi_start, movi.size);
+    return true;
+}
+
+static bool next_chunk_head(avi_data_t *avi, AVI_CHUNK_HEAD *head, uint32_t *start)
+{
+    if (avi->AVI_file.vids_index.count > 0 || avi->AVI_file.auds_index.count > 0) {
+        uint64_t offset;
+        if (!next_indexed_chunk(avi, &offset, start)) {
+            return false;
+        }
+        if (offset != get_read_offset(avi) && !set_read_offset(avi, offset)) {
+            return false;
+        }
+        return read_chunk_head(avi, head);
+    }
+
+    /*!< no index: walk the movi list linearly, then the movi lists of the "AVIX" RIFFs */
+    while (1) {
+        uint64_t movi_end = avi->AVI_file.movi_start - 4 + avi->AVI_file.movi_size;
+        if (get_read_offset(avi) + sizeof(AVI_CHUNK_HEAD) > movi_end && !next_riff_movi(avi)) {
+            return false;
+        }
+        if (!read_chunk_head(avi, head)) {
+            return false;
+        }
+        /*!< count the stream positions the index would have given */
+        if ((head->FourCC & 0xFFFF0000) == DC_ID) {
+            *start = avi->vids_next++;
+            return true;
+        } else if ((head->FourCC & 0xFFFF0000) == WB_ID) {
+            *start = avi->auds_next;
+            avi->auds_next += avi_auds_duration(&avi->AVI_file, head->size);
+            return true;
+        }
+        if (head->FourCC == LIST_ID && head->size >= sizeof(uint32_t)) {
+            uint32_t fourcc;
+            if (!read_data(avi, &fourcc, sizeof(fourcc))) {
+                return false;
+            }
+            if (fourcc == REC_ID) {
+                continue;    /*!< step into the "rec " list, the chunks it groups follow */
+            }
+            head->size -= sizeof(fourcc);
+        }
+        /*!< "JUNK", "ix##" standard indexes, palette changes and unknown chunks: seek past the payload */
+        ESP_LOGD(TAG, "skip chunk 0x%08"PRIx32", %"PRIu32" bytes", head->FourCC, head->size);
+        if (!skip_chunk_data(avi, head->size)) {
+            return false;
         }
+    }
+}
+
+static void av_clock_reset(avi_data_t *avi, int64_t pts_us)
+{
+    avi->clock_base_pts = pts_us;
+    avi->clock_base_time = esp_timer_get_time();
+    avi->audio_end_pts = -1;
+    avi->audio_drain_time = -1;
+    avi->clock_sample_pts = pts_us;
+    avi->clock_sample_time = avi->clock_base_time;
+    avi->has_pending = false;
+}
+
+static int64_t av_clock_compute(avi_player_handle_t player)
+{
+    avi_data_t *avi = &player->avi_data;
+    int64_t now = esp_timer_get_time();
+
+    if (player->config.audio_queued_cb == NULL || avi->audio_end_pts < 0 || avi->AVI_file.auds_sample_rate == 0) {
+        return avi->clock_base_pts + (now - avi->clock_base_time);
+    }
+    /*!< audio master: the end of the audio handed out so far, minus what the output has not played yet */
+    uint32_t queued = player->config.audio_queued_cb(player->config.user_data);
+    if (queued > 0) {
+        avi->audio_drain_time = -1;
+        return avi->audio_end_pts - (int64_t)queued * 1000000 / avi->AVI_file.auds_sample_rate;
+    }
+    /*!< the output ran dry (end of the audio track or an underrun): keep time with the wall clock from there */
+    if (avi->audio_drain_time < 0) {
+        avi->audio_drain_time = now;
+    }
+    return avi->audio_end_pts + (now - avi->audio_drain_time);
+}
+
+static int64_t av_clock_us(avi_player_handle_t player)
+{
+    int64_t clock_us = av_clock_compute(player);
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&player->clock_lock);
+    player->avi_data.clock_sample_pts = clock_us;
+    player->avi_data.clock_sample_time = now;
+    portEXIT_CRITICAL(&player->clock_lock);
+    return clock_us;
+}
+
+static esp_err_t seek_to(avi_data_t *avi, int64_t pts_us)
+{
+    avi_typedef *AVI_file = &avi->AVI_file;
+    ESP_RETURN_ON_FALSE(AVI_file->vids_index.count > 0 && AVI_file->vids_rate > 0, ESP_ERR_NOT_SUPPORTED, TAG, "no index to seek with");
+
+    if (pts_us < 0) {
+        pts_us = 0;
+    }
+    uint32_t frame = (uint64_t)pts_us * AVI_file->vids_rate / ((uint64_t)AVI_file->vids_scale * 1000000);
+    avi->vids_cursor = avi_index_lookup(&AVI_file->vids_index, frame);
+    const avi_index_entry_t *vids = &AVI_file->vids_index.entries[avi->vids_cursor];
+
+    int64_t frame_us = avi_vids_pts_us(AVI_file, vids->start);
+    if (AVI_file->auds_index.count > 0 && AVI_file->auds_rate > 0) {
+        /*!< resume audio at the block that plays together with the chosen video frame */
+        uint32_t block = (uint64_t)frame_us * AVI_file->auds_rate / ((uint64_t)AVI_file->auds_scale * 1000000);
+        avi->auds_cursor = avi_index_lookup(&AVI_file->auds_index, block);
+    }
+    av_clock_reset(avi, frame_us);
+    /*!< the next chunk read lseeks to the earlier of both entries */
+    ESP_LOGI(TAG, "seek to frame %"PRIu32" at %"PRIu64"", vids->start, vids->offset);
+    return ESP_OK;
+}
 
-        ret = avi_parser(&s_avi->avi_data.AVI_file, s_avi->avi_data.pbuffer, BytesRD);
+static esp_err_t avi_player(avi_player_handle_t handle)
+{
+    int ret;
+
+    switch (handle->avi_data.state) {
+    case AVI_PARSER_HEADER: {
+        ret = avi_parser(&handle->avi_data.AVI_file, parser_read, &handle->avi_data);
         if (0 > ret) {
             ESP_LOGE(TAG, "parse failed (%d)", ret);
-            xEventGroupSetBits(s_avi->event_group, EVENT_STOP_PLAY);
+            xEventGroupSetBits(handle->event_group, EVENT_STOP_PLAY);
             return ESP_FAIL;
         }
 
-        /*!< Set the video callback */
-        if (s_avi->config.audio_set_clock_cb) {
-            s_avi->config.audio_set_clock_cb(
-                             s_avi->avi_data.AVI_file.auds_sample_rate,
-                             s_avi->avi_data.AVI_file.auds_bits,
-                             s_avi->avi_data.AVI_file.auds_channels,
-                             s_avi->config.user_data);
-        }
-
-        uint32_t fps_time = 1000 * 1000 / s_avi->avi_data.AVI_file.vids_fps;
-        ESP_LOGD(TAG, "vids_fps=%d", s_avi->avi_data.AVI_file.vids_fps);
-        esp_timer_start_periodic(s_avi->timer_handle, fps_time);
+        ESP_LOGD(TAG, "video rate %"PRIu32"/%"PRIu32", audio rate %"PRIu32"/%"PRIu32"",
+                 handle->avi_data.AVI_file.vids_rate, handle->avi_data.AVI_file.vids_scale,
+                 handle->avi_data.AVI_file.auds_rate, handle->avi_data.AVI_file.auds_scale);
 
-        if (s_avi->avi_data.mode == PLAY_MEMORY) {
-            s_avi->avi_data.memory.read_offset = s_avi->avi_data.AVI_file.movi_start;
-        } else {
-            lseek(s_avi->avi_data.file.avi_file, s_avi->avi_data.AVI_file.movi_start, SEEK_SET);
+        /*!< the index is loaded in small blocks, the size the chunks need is known afterwards */
+        if (!reserve_buffer(handle, 0)) {
+            xEventGroupSetBits(handle->event_group, EVENT_STOP_PLAY);
+            return ESP_ERR_NO_MEM;
+        }
+        load_index(&handle->avi_data, handle->avi_data.pbuffer, handle->avi_data.pbuffer_size);
+        reserve_buffer(handle, stream_buffer_size(handle));
+        if (handle->avi_data.mode == PLAY_FILE && handle->config.read_ahead_size > 0) {
+            /*!< stream the movi data through the read-ahead ring so storage stalls don't reach the frame timer */
+            avi_reader_config_t reader_cfg = {
+                .fd = handle->avi_data.file.avi_file,
+                .ring_size = handle->config.read_ahead_size,
+                .block_size = handle->config.read_ahead_block,
+                .priority = handle->config.priority + 1,
+                .coreID = handle->config.coreID,
+            };
+            if (avi_reader_create(&reader_cfg, handle->avi_data.AVI_file.movi_start, &handle->avi_data.file.reader) != ESP_OK) {
+                ESP_LOGW(TAG, "read-ahead disabled");
+                handle->avi_data.file.reader = NULL;
+            }
+        }
+        set_read_offset(&handle->avi_data, handle->avi_data.AVI_file.movi_start);
+
+        handle->avi_data.riff_end = handle->avi_data.AVI_file.RIFFchunksize + sizeof(AVI_CHUNK_HEAD);
+        handle->avi_data.vids_cursor = 0;
+        handle->avi_data.auds_cursor = 0;
+        handle->avi_data.vids_next = 0;
+        handle->avi_data.auds_next = 0;
+        memset(&handle->avi_data.stats, 0, sizeof(avi_player_stats_t));
+
+        handle->avi_data.state = AVI_PARSER_READY;
+        if (!handle->avi_data.autoplay) {
+            /*!< prepared: the read-ahead keeps filling until avi_player_play_prepared() */
+            return ESP_OK;
         }
-
-        s_avi->avi_data.state = AVI_PARSER_DATA;
-        BytesRD = 0;
     }
+    case AVI_PARSER_READY:
+        /*!< Set the audio clock */
+        if (handle->config.audio_set_clock_cb) {
+            handle->config.audio_set_clock_cb(
+                             handle->avi_data.AVI_file.auds_sample_rate,
+                             handle->avi_data.AVI_file.auds_bits,
+                             handle->avi_data.AVI_file.auds_channels,
+                             handle->config.user_data);
+        }
+        av_clock_reset(&handle->avi_data, 0);
+        handle->avi_data.state = AVI_PARSER_DATA;
     case AVI_PARSER_DATA: {
+        int64_t late_us = handle->config.late_threshold_us ? handle->config.late_threshold_us : avi_vids_pts_us(&handle->avi_data.AVI_file, 1);
         /*!< clear event */
-        xEventGroupClearBits(s_avi->event_group, EVENT_AUDIO_BUF_READY | EVENT_VIDEO_BUF_READY);
+        xEventGroupClearBits(handle->event_group, EVENT_AUDIO_BUF_READY | EVENT_VIDEO_BUF_READY);
         while (1) {
-            s_avi->avi_data.str_size = read_frame(&s_avi->avi_data, s_avi->avi_data.pbuffer, buffer_size, &Strtype);
-            ESP_LOGD(TAG, "type=%"PRIu32", size=%"PRIu32"", Strtype, s_avi->avi_data.str_size);
-            BytesRD += s_avi->avi_data.str_size + 8;
-
-            if (BytesRD >= s_avi->avi_data.AVI_file.movi_size) {
-                ESP_LOGI(TAG, "play end");
-                s_avi->avi_data.state = AVI_PARSER_END;
-                xEventGroupSetBits(s_avi->event_group, EVENT_STOP_PLAY);
-                return ESP_OK;
+            avi_data_t *avi = &handle->avi_data;
+            if (!avi->has_pending) {
+                if (!next_chunk_head(avi, &avi->pending, &avi->pending_start)) {
+                    ESP_LOGI(TAG, "play end");
+                    avi->state = AVI_PARSER_END;
+                    xEventGroupSetBits(handle->event_group, EVENT_STOP_PLAY);
+                    return ESP_OK;
+                }
+                avi->has_pending = true;
+            }
+            AVI_CHUNK_HEAD head = avi->pending;
+            uint32_t Strtype = head.FourCC;
+            int64_t pts_us = 0;
+
+            if ((Strtype & 0xFFFF0000) == DC_ID) {
+                /*!< schedule the frame against the master clock: hold it while early, drop it once a frame late */
+                pts_us = avi_vids_pts_us(&avi->AVI_file, avi->pending_start);
+                int64_t clock_us = av_clock_us(handle);
+                if (pts_us - clock_us > AV_SYNC_EARLY_US) {
+                    esp_timer_stop(handle->timer_handle);
+                    esp_timer_start_once(handle->timer_handle, pts_us - clock_us);
+                    return ESP_OK;
+                }
+                avi->has_pending = false;
+                if (clock_us - pts_us > late_us) {
+                    ESP_LOGD(TAG, "frame %"PRIu32" late by %"PRId64"us, skipped", avi->pending_start, clock_us - pts_us);
+                    if (!skip_chunk_data(avi, head.size)) {
+                        return end_at_bad_chunk(handle);
+                    }
+                    avi->stats.video_skipped++;
+                    continue;
+                }
+            } else if ((Strtype & 0xFFFF0000) == WB_ID) {
+                pts_us = avi_auds_pts_us(&avi->AVI_file, avi->pending_start);
+                avi->audio_end_pts = avi_auds_pts_us(&avi->AVI_file, avi->pending_start + avi_auds_duration(&avi->AVI_file, head.size));
+                avi->has_pending = false;
+            } else {
+                /*!< a chunk of another stream, or "##db" from the index: not played, skipped without reading it */
+                avi->has_pending = false;
+                ESP_LOGD(TAG, "skip chunk 0x%08"PRIx32", %"PRIu32" bytes", Strtype, head.size);
+                if (!skip_chunk_data(avi, head.size)) {
+                    return end_at_bad_chunk(handle);
+                }
+                continue;
+            }
+
+            if ((Strtype & 0xFFFF0000) == DC_ID && handle->config.video_buffer_cb) {
+                /*!< read the frame straight into a buffer owned by the caller, it is handed back through video_cb */
+                uint8_t *buffer = handle->config.video_buffer_cb(head.size, handle->config.user_data);
+                if (buffer == NULL) {
+                    ESP_LOGD(TAG, "no video buffer, frame dropped");
+                    avi->stats.video_dropped++;
+                    if (!skip_chunk_data(avi, head.size)) {
+                        return end_at_bad_chunk(handle);
+                    }
+                    break;
+                }
+                frame_data_t data = {
+                    .data = buffer,
+                    .data_bytes = read_chunk_data(avi, buffer, head.size, head.size),
+                    .type = FRAME_TYPE_VIDEO,
+                    .pts_us = pts_us,
+                    .video_info.width = avi->AVI_file.vids_width,
+                    .video_info.height = avi->AVI_file.vids_height,
+                    .video_info.frame_format = avi->AVI_file.vids_format,
+                };
+                if (handle->config.video_cb) {
+                    handle->config.video_cb(&data, handle->config.user_data);
+                }
+                avi->stats.video_frames++;
+                break;
             }
 
+            /*!< a chunk larger than the hints grows the buffer, up to buffer_size */
+            reserve_buffer(handle, head.size);
+            avi->str_size = read_chunk_data(avi, avi->pbuffer, avi->pbuffer_size, head.size);
+            ESP_LOGD(TAG, "type=%"PRIu32", size=%"PRIu32"", Strtype, avi->str_size);
+
             if ((Strtype & 0xFFFF0000) == DC_ID) { // Display frame
                 int64_t fr_end = esp_timer_get_time();
-                if (s_avi->config.video_cb) {
+                if (handle->config.video_cb) {
                     frame_data_t data = {
-                        .data = s_avi->avi_data.pbuffer,
-                        .data_bytes = s_avi->avi_data.str_size,
+                        .data = avi->pbuffer,
+                        .data_bytes = avi->str_size,
                         .type = FRAME_TYPE_VIDEO,
-                        .video_info.width = s_avi->avi_data.AVI_file.vids_width,
-                        .video_info.height = s_avi->avi_data.AVI_file.vids_height,
-                        .video_info.frame_format = s_avi->avi_data.AVI_file.vids_format,
+                        .pts_us = pts_us,
+                        .video_info.width = avi->AVI_file.vids_width,
+                        .video_info.height = avi->AVI_file.vids_height,
+                        .video_info.frame_format = avi->AVI_file.vids_format,
                     };
-                    s_avi->config.video_cb(&data, s_avi->config.user_data);
+                    handle->config.video_cb(&data, handle->config.user_data);
                 }
-                xEventGroupSetBits(s_avi->event_group, EVENT_VIDEO_BUF_READY);
+                avi->stats.video_frames++;
+                xEventGroupSetBits(handle->event_group, EVENT_VIDEO_BUF_READY);
                 ESP_LOGD(TAG, "Draw %"PRIu32"ms", (uint32_t)((esp_timer_get_time() - fr_end) / 1000));
                 break;
             } else if ((Strtype & 0xFFFF0000) == WB_ID) { // Audio output
-                if (s_avi->config.audio_cb) {
+                if (handle->config.audio_cb) {
                     frame_data_t data = {
-                        .data = s_avi->avi_data.pbuffer,
-                        .data_bytes = s_avi->avi_data.str_size,
+                        .data = avi->pbuffer,
+                        .data_bytes = avi->str_size,
                         .type = FRAME_TYPE_AUDIO,
-                        .audio_info.channel = s_avi->avi_data.AVI_file.auds_channels,
-                        .audio_info.bits_per_sample = s_avi->avi_data.AVI_file.auds_bits,
-                        .audio_info.sample_rate = s_avi->avi_data.AVI_file.auds_sample_rate,
-                        .audio_info.format = s_avi->avi_data.AVI_file.auds_format,
+                        .pts_us = pts_us,
+                        .audio_info.channel = avi->AVI_file.auds_channels,
+                        .audio_info.bits_per_sample = avi->AVI_file.auds_bits,
+                        .audio_info.sample_rate = avi->AVI_file.auds_sample_rate,
+                        .audio_info.format = avi->AVI_file.auds_format,
                     };
-                    s_avi->config.audio_cb(&data, s_avi->config.user_data);
+                    handle->config.audio_cb(&data, handle->config.user_data);
                 }
-                xEventGroupSetBits(s_avi->event_group, EVENT_AUDIO_BUF_READY);
-            } else {
-                ESP_LOGE(TAG, "unknown frame %"PRIx32"", Strtype);
-                xEventGroupSetBits(s_avi->event_group, EVENT_STOP_PLAY);
-                return ESP_FAIL;
+                xEventGroupSetBits(handle->event_group, EVENT_AUDIO_BUF_READY);
             }
         }
+        /*!< come back for the next chunk after the pending events were handled */
+        xEventGroupSetBits(handle->event_group, EVENT_FPS_TIME_UP);
         break;
     }
     case AVI_PARSER_END:
-        esp_timer_stop(s_avi->timer_handle);
-        if (s_avi->avi_data.mode == PLAY_FILE) {
-            close(s_avi->avi_data.file.avi_file);
+        esp_timer_stop(handle->timer_handle);
+        if (handle->avi_data.mode == PLAY_FILE) {
+            avi_reader_delete(handle->avi_data.file.reader);
+            handle->avi_data.file.reader = NULL;
+            close(handle->avi_data.file.avi_file);
         }
+        avi_index_free(&handle->avi_data.AVI_file);
 
-        s_avi->avi_data.state = AVI_PARSER_NONE;
-        if (s_avi->config.avi_play_end_cb) {
-            s_avi->config.avi_play_end_cb(s_avi->config.user_data);
+        portENTER_CRITICAL(&handle->state_lock);
+        handle->avi_data.state = AVI_PARSER_NONE;
+        portEXIT_CRITICAL(&handle->state_lock);
+        if (handle->config.avi_play_end_cb) {
+            handle->config.avi_play_end_cb(handle->config.user_data);
         }
 
         break;
@@ -236,28 +693,50 @@ static esp_err_t avi_player(void)
 
 static void avi_player_task(void *args)
 {
+    avi_player_handle_t handle = (avi_player_handle_t)args;
     EventBits_t uxBits;
     bool exit = false;
     while (!exit) {
-        uxBits = xEventGroupWaitBits(s_avi->event_group, EVENT_ALL, pdTRUE, pdFALSE, portMAX_DELAY);
-        if (uxBits & EVENT_STOP_PLAY) {
-            s_avi->avi_data.state = AVI_PARSER_END;
-            esp_err_t ret = avi_player();
+        uxBits = xEventGroupWaitBits(handle->event_group, EVENT_ALL, pdTRUE, pdFALSE, portMAX_DELAY);
+        if ((uxBits & EVENT_STOP_PLAY) && handle->avi_data.state != AVI_PARSER_NONE) {
+            handle->avi_data.state = AVI_PARSER_END;
+            esp_err_t ret = avi_player(handle);
+            if (ret != ESP_OK) {
+                ESP_LOGI(TAG, "AVI Perse failed");
+            }
+        }
+
+        /*!< the open already moved the state to HEADER, a stop handled above ended the file before its parse */
+        if ((uxBits & EVENT_START_PLAY) && handle->avi_data.state == AVI_PARSER_HEADER) {
+            esp_err_t ret = avi_player(handle);
             if (ret != ESP_OK) {
                 ESP_LOGI(TAG, "AVI Perse failed");
             }
         }
 
-        if (uxBits & EVENT_START_PLAY) {
-            s_avi->avi_data.state = AVI_PARSER_HEADER;
-            esp_err_t ret = avi_player();
+        if ((uxBits & EVENT_PLAY_PREPARED) && handle->avi_data.state == AVI_PARSER_READY) {
+            esp_err_t ret = avi_player(handle);
             if (ret != ESP_OK) {
                 ESP_LOGI(TAG, "AVI Perse failed");
             }
         }
 
+        if ((uxBits & EVENT_SEEK) && handle->avi_data.state == AVI_PARSER_DATA) {
+            esp_err_t ret = seek_to(&handle->avi_data, handle->avi_data.seek_pts_us);
+            if (ret != ESP_OK) {
+                ESP_LOGI(TAG, "AVI seek failed");
+            } else {
+                if (handle->config.seek_done_cb) {
+                    handle->config.seek_done_cb(handle->config.user_data);
+                }
+                /*!< drop the wait for the frame before the seek */
+                esp_timer_stop(handle->timer_handle);
+                xEventGroupSetBits(handle->event_group, EVENT_FPS_TIME_UP);
+            }
+        }
+
         if (uxBits & EVENT_FPS_TIME_UP) {
-            esp_err_t ret = avi_player();
+            esp_err_t ret = avi_player(handle);
             if (ret != ESP_OK) {
                 ESP_LOGI(TAG, "AVI Perse failed");
             }
@@ -269,157 +748,260 @@ static void avi_player_task(void *args)
         }
 
     }
-    xEventGroupSetBits(s_avi->event_group, EVENT_DEINIT_DONE);
+    xEventGroupSetBits(handle->event_group, EVENT_DEINIT_DONE);
     vTaskDelete(NULL);
 }
 
-esp_err_t avi_player_get_video_buffer(void **buffer, size_t *buffer_size, video_frame_info_t *info, TickType_t ticks_to_wait)
+esp_err_t avi_player_get_video_buffer(avi_player_handle_t handle, void **buffer, size_t *buffer_size, video_frame_info_t *info, TickType_t ticks_to_wait)
 {
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
     ESP_RETURN_ON_FALSE(buffer != NULL, ESP_ERR_INVALID_ARG, TAG, "buffer can’t be NULL");
     ESP_RETURN_ON_FALSE(info != NULL, ESP_ERR_INVALID_ARG, TAG, "info can’t be NULL");
     ESP_RETURN_ON_FALSE(buffer_size != NULL, ESP_ERR_INVALID_ARG, TAG, "buffer_size can’t be 0");
 
     /*!< Get the EVENT_VIDEO_BUF_READY */
-    EventBits_t uxBits = xEventGroupWaitBits(s_avi->event_group, EVENT_VIDEO_BUF_READY, pdTRUE, pdFALSE, ticks_to_wait);
+    EventBits_t uxBits = xEventGroupWaitBits(handle->event_group, EVENT_VIDEO_BUF_READY, pdTRUE, pdFALSE, ticks_to_wait);
     if (!(uxBits & EVENT_VIDEO_BUF_READY)) {
         return ESP_ERR_TIMEOUT;
     }
 
-    if (*buffer_size < s_avi->avi_data.str_size) {
+    if (*buffer_size < handle->avi_data.str_size) {
         ESP_LOGE(TAG, "buffer size is too small");
         return ESP_ERR_NO_MEM;
     }
 
-    memcpy(*buffer, s_avi->avi_data.pbuffer, s_avi->avi_data.str_size);
-    *buffer_size = s_avi->avi_data.str_size;
-    info->width = s_avi->avi_data.AVI_file.vids_width;
-    info->height = s_avi->avi_data.AVI_file.vids_height;
-    info->frame_format = s_avi->avi_data.AVI_file.vids_format;
+    memcpy(*buffer, handle->avi_data.pbuffer, handle->avi_data.str_size);
+    *buffer_size = handle->avi_data.str_size;
+    info->width = handle->avi_data.AVI_file.vids_width;
+    info->height = handle->avi_data.AVI_file.vids_height;
+    info->frame_format = handle->avi_data.AVI_file.vids_format;
     return ESP_OK;
 }
 
-esp_err_t avi_player_get_audio_buffer(void **buffer, size_t *buffer_size, audio_frame_info_t *info, TickType_t ticks_to_wait)
+esp_err_t avi_player_get_audio_buffer(avi_player_handle_t handle, void **buffer, size_t *buffer_size, audio_frame_info_t *info, TickType_t ticks_to_wait)
 {
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
     ESP_RETURN_ON_FALSE(buffer != NULL, ESP_ERR_INVALID_ARG, TAG, "buffer can’t be NULL");
     ESP_RETURN_ON_FALSE(info != NULL, ESP_ERR_INVALID_ARG, TAG, "info can’t be NULL");
     ESP_RETURN_ON_FALSE(buffer_size != NULL, ESP_ERR_INVALID_ARG, TAG, "buffer_size can’t be 0");
 
     /*!< Get the EVENT_AUDIO_BUF_READY */
-    EventBits_t uxBits = xEventGroupWaitBits(s_avi->event_group, EVENT_AUDIO_BUF_READY, pdTRUE, pdFALSE, ticks_to_wait);
+    EventBits_t uxBits = xEventGroupWaitBits(handle->event_group, EVENT_AUDIO_BUF_READY, pdTRUE, pdFALSE, ticks_to_wait);
     if (!(uxBits & EVENT_AUDIO_BUF_READY)) {
         return ESP_ERR_TIMEOUT;
     }
 
-    if (*buffer_size < s_avi->avi_data.str_size) {
+    if (*buffer_size < handle->avi_data.str_size) {
         ESP_LOGE(TAG, "buffer size is too small");
         return ESP_ERR_NO_MEM;
     }
 
-    memcpy(*buffer, s_avi->avi_data.pbuffer, s_avi->avi_data.str_size);
-    *buffer_size = s_avi->avi_data.str_size;
-    info->channel = s_avi->avi_data.AVI_file.auds_channels;
-    info->bits_per_sample = s_avi->avi_data.AVI_file.auds_bits;
-    info->sample_rate = s_avi->avi_data.AVI_file.auds_sample_rate;
+    memcpy(*buffer, handle->avi_data.pbuffer, handle->avi_data.str_size);
+    *buffer_size = handle->avi_data.str_size;
+    info->channel = handle->avi_data.AVI_file.auds_channels;
+    info->bits_per_sample = handle->avi_data.AVI_file.auds_bits;
+    info->sample_rate = handle->avi_data.AVI_file.auds_sample_rate;
     info->format = FORMAT_PCM;
     return ESP_OK;
 }
 
-esp_err_t avi_player_play_from_memory(uint8_t *avi_data, size_t avi_size)
+esp_err_t avi_player_play_from_memory(avi_player_handle_t handle, uint8_t *avi_data, size_t avi_size)
 {
-    ESP_RETURN_ON_FALSE(s_avi->avi_data.state == AVI_PARSER_NONE, ESP_ERR_INVALID_STATE, TAG, "AVI player not ready");
-    s_avi->avi_data.mode = PLAY_MEMORY;
-    s_avi->avi_data.memory.data = avi_data;
-    s_avi->avi_data.memory.size = avi_size;
-    s_avi->avi_data.memory.read_offset = 0;
-    xEventGroupSetBits(s_avi->event_group, EVENT_START_PLAY);
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
+    bool claimed = false;
+    portENTER_CRITICAL(&handle->state_lock);
+    if (handle->avi_data.state == AVI_PARSER_NONE) {
+        handle->avi_data.mode = PLAY_MEMORY;
+        handle->avi_data.memory.data = avi_data;
+        handle->avi_data.memory.size = avi_size;
+        handle->avi_data.memory.read_offset = 0;
+        handle->avi_data.autoplay = true;
+        handle->avi_data.state = AVI_PARSER_HEADER;
+        claimed = true;
+    }
+    portEXIT_CRITICAL(&handle->state_lock);
+    ESP_RETURN_ON_FALSE(claimed, ESP_ERR_INVALID_STATE, TAG, "AVI player not ready");
+    xEventGroupSetBits(handle->event_group, EVENT_START_PLAY);
     return ESP_OK;
 }
 
-esp_err_t avi_player_play_from_file(const char *filename)
+static esp_err_t open_file(avi_player_handle_t handle, const char *filename, bool autoplay)
 {
-    ESP_RETURN_ON_FALSE(s_avi->avi_data.state == AVI_PARSER_NONE, ESP_ERR_INVALID_STATE, TAG, "AVI player not ready");
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
+    ESP_RETURN_ON_FALSE(handle->avi_data.state == AVI_PARSER_NONE, ESP_ERR_INVALID_STATE, TAG, "AVI player not ready");
 
-    s_avi->avi_data.mode = PLAY_FILE;
-    s_avi->avi_data.file.avi_file = open(filename, O_RDONLY);
-    if (s_avi->avi_data.file.avi_file < 0) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
         ESP_LOGE(TAG, "Cannot open %s", filename);
         return ESP_FAIL;
     }
-    xEventGroupSetBits(s_avi->event_group, EVENT_START_PLAY);
+    /*!< HEADER from here on, so that stop and play_prepared work before the task parses and a second open fails */
+    bool claimed = false;
+    portENTER_CRITICAL(&handle->state_lock);
+    if (handle->avi_data.state == AVI_PARSER_NONE) {
+        handle->avi_data.mode = PLAY_FILE;
+        handle->avi_data.file.read_offset = 0;
+        handle->avi_data.file.reader = NULL;
+        handle->avi_data.file.avi_file = fd;
+        handle->avi_data.autoplay = autoplay;
+        handle->avi_data.state = AVI_PARSER_HEADER;
+        claimed = true;
+    }
+    portEXIT_CRITICAL(&handle->state_lock);
+    if (!claimed) {
+        close(fd);
+        ESP_LOGE(TAG, "AVI player not ready");
+        return ESP_ERR_INVALID_STATE;
+    }
+    xEventGroupSetBits(handle->event_group, EVENT_START_PLAY);
     return ESP_OK;
 }
 
-esp_err_t avi_player_play_stop(void)
+esp_err_t avi_player_play_from_file(avi_player_handle_t handle, const char *filename)
+{
+    return open_file(handle, filename, true);
+}
+
+esp_err_t avi_player_prepare_from_file(avi_player_handle_t handle, const char *filename)
+{
+    return open_file(handle, filename, false);
+}
+
+esp_err_t avi_player_play_prepared(avi_player_handle_t handle)
 {
-    ESP_RETURN_ON_FALSE(s_avi->avi_data.state == AVI_PARSER_HEADER || s_avi->avi_data.state == AVI_PARSER_DATA,
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
+    ESP_RETURN_ON_FALSE(handle->avi_data.state == AVI_PARSER_HEADER || handle->avi_data.state == AVI_PARSER_READY,
+                        ESP_ERR_INVALID_STATE, TAG, "AVI player not prepared");
+    /*!< still parsing: start right after the header */
+    handle->avi_data.autoplay = true;
+    xEventGroupSetBits(handle->event_group, EVENT_PLAY_PREPARED);
+    return ESP_OK;
+}
+
+esp_err_t avi_player_play_stop(avi_player_handle_t handle)
+{
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
+    ESP_RETURN_ON_FALSE(handle->avi_data.state == AVI_PARSER_HEADER || handle->avi_data.state == AVI_PARSER_READY ||
+                        handle->avi_data.state == AVI_PARSER_DATA,
                         ESP_ERR_INVALID_STATE, TAG, "AVI player not playing");
-    xEventGroupSetBits(s_avi->event_group, EVENT_STOP_PLAY);
+    xEventGroupSetBits(handle->event_group, EVENT_STOP_PLAY);
+    return ESP_OK;
+}
+
+esp_err_t avi_player_seek(avi_player_handle_t handle, int64_t pts_us)
+{
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
+    ESP_RETURN_ON_FALSE(handle->avi_data.state == AVI_PARSER_DATA, ESP_ERR_INVALID_STATE, TAG, "AVI player not playing");
+    ESP_RETURN_ON_FALSE(handle->avi_data.AVI_file.vids_index.count > 0, ESP_ERR_NOT_SUPPORTED, TAG, "AVI file has no index");
+    handle->avi_data.seek_pts_us = pts_us;
+    xEventGroupSetBits(handle->event_group, EVENT_SEEK);
+    return ESP_OK;
+}
+
+esp_err_t avi_player_get_clock(avi_player_handle_t handle, int64_t *pts_us)
+{
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
+    ESP_RETURN_ON_FALSE(pts_us != NULL, ESP_ERR_INVALID_ARG, TAG, "pts_us can’t be NULL");
+    ESP_RETURN_ON_FALSE(handle->avi_data.state == AVI_PARSER_DATA, ESP_ERR_INVALID_STATE, TAG, "AVI player not playing");
+    portENTER_CRITICAL(&handle->clock_lock);
+    int64_t sample_pts = handle->avi_data.clock_sample_pts;
+    int64_t sample_time = handle->avi_data.clock_sample_time;
+    portEXIT_CRITICAL(&handle->clock_lock);
+    *pts_us = sample_pts + (esp_timer_get_time() - sample_time);
+    return ESP_OK;
+}
+
+esp_err_t avi_player_get_stats(avi_player_handle_t handle, avi_player_stats_t *stats)
+{
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
+    ESP_RETURN_ON_FALSE(stats != NULL, ESP_ERR_INVALID_ARG, TAG, "stats can’t be NULL");
+    *stats = handle->avi_data.stats;
     return ESP_OK;
 }
 
 static void esp_timer_cb(void *arg)
 {
+    avi_player_handle_t handle = (avi_player_handle_t)arg;
     /*!< Give the Event */
-    xEventGroupSetBits(s_avi->event_group, EVENT_FPS_TIME_UP);
+    xEventGroupSetBits(handle->event_group, EVENT_FPS_TIME_UP);
 }
 
-esp_err_t avi_player_init(avi_player_config_t config)
+esp_err_t avi_player_init(avi_player_config_t config, avi_player_handle_t *ret_handle)
 {
     ESP_LOGI(TAG, "AVI Player Version: %d.%d.%d", AVI_PLAYER_VER_MAJOR, AVI_PLAYER_VER_MINOR, AVI_PLAYER_VER_PATCH);
-    ESP_RETURN_ON_FALSE(s_avi == NULL, ESP_ERR_INVALID_STATE, TAG, "avi player already initialized");
-    s_avi = (avi_player_handle_t *)calloc(1, sizeof(avi_player_handle_t));
-    s_avi->config = config;
-
-    if (s_avi->config.buffer_size == 0) {
-        s_avi->config.buffer_size = 20 * 1024;
+    ESP_RETURN_ON_FALSE(ret_handle != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
+    esp_err_t ret = ESP_OK;
+    avi_player_handle_t handle = (avi_player_handle_t)calloc(1, sizeof(struct avi_player_t));
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_NO_MEM, TAG, "Cannot alloc memory for player");
+    handle->config = config;
+    portMUX_INITIALIZE(&handle->clock_lock);
+    portMUX_INITIALIZE(&handle->state_lock);
+
+    if (handle->config.buffer_size == 0) {
+        handle->config.buffer_size = 20 * 1024;
     }
-    if (s_avi->config.priority == 0) {
-        s_avi->config.priority = 5;
+    if (handle->config.priority == 0) {
+        handle->config.priority = 5;
+    }
+    if (handle->config.read_ahead_block == 0) {
+        handle->config.read_ahead_block = 64 * 1024;
     }
-
-    s_avi->avi_data.pbuffer = malloc(s_avi->config.buffer_size);
-    ESP_RETURN_ON_FALSE(s_avi->avi_data.pbuffer != NULL, ESP_ERR_NO_MEM, TAG, "Cannot alloc memory for player");
 
     esp_timer_create_args_t timer = {0};
-    timer.arg = NULL;
+    timer.arg = handle;
     timer.callback = esp_timer_cb;
     timer.dispatch_method = ESP_TIMER_TASK;
     timer.name = "avi_player_timer";
-    s_avi->event_group = xEventGroupCreate();
-    ESP_RETURN_ON_FALSE(s_avi->event_group != NULL, ESP_ERR_NO_MEM, TAG, "Cannot create event group");
+    handle->event_group = xEventGroupCreate();
+    ESP_GOTO_ON_FALSE(handle->event_group != NULL, ESP_ERR_NO_MEM, err, TAG, "Cannot create event group");
 
-    esp_timer_create(&timer, &s_avi->timer_handle);
-    xTaskCreatePinnedToCore(avi_player_task, "avi_player", 4096, NULL, s_avi->config.priority, NULL, s_avi->config.coreID);
+    ESP_GOTO_ON_ERROR(esp_timer_create(&timer, &handle->timer_handle), err, TAG, "Cannot create timer");
+    ESP_GOTO_ON_FALSE(xTaskCreatePinnedToCore(avi_player_task, "avi_player", 4096, handle, handle->config.priority, NULL,
+                                              handle->config.coreID) == pdPASS, ESP_ERR_NO_MEM, err, TAG, "Cannot create player task");
+    *ret_handle = handle;
     return ESP_OK;
+
+err:
+    if (handle->timer_handle != NULL) {
+        esp_timer_delete(handle->timer_handle);
+    }
+    if (handle->event_group != NULL) {
+        vEventGroupDelete(handle->event_group);
+    }
+    free(handle);
+    return ret;
 }
 
-esp_err_t avi_player_deinit(void)
+esp_err_t avi_player_deinit(avi_player_handle_t handle)
 {
-    if (s_avi == NULL) {
-        return ESP_FAIL;
-    }
+    ESP_RETURN_ON_FALSE(handle != NULL, ESP_ERR_INVALID_ARG, TAG, "handle can’t be NULL");
 
-    xEventGroupSetBits(s_avi->event_group, EVENT_DEINIT);
-    EventBits_t uxBits = xEventGroupWaitBits(s_avi->event_group, EVENT_DEINIT_DONE, pdTRUE, pdTRUE, pdMS_TO_TICKS(1000));
+    xEventGroupSetBits(handle->event_group, EVENT_DEINIT);
+    EventBits_t uxBits = xEventGroupWaitBits(handle->event_group, EVENT_DEINIT_DONE, pdTRUE, pdTRUE, pdMS_TO_TICKS(1000));
     if (!(uxBits & EVENT_DEINIT_DONE)) {
         ESP_LOGE(TAG, "AVI player deinit timeout");
         return ESP_ERR_TIMEOUT;
     }
 
-    if (s_avi->timer_handle != NULL) {
-        esp_timer_stop(s_avi->timer_handle);
-        esp_timer_delete(s_avi->timer_handle);
+    if (handle->timer_handle != NULL) {
+        esp_timer_stop(handle->timer_handle);
+        esp_timer_delete(handle->timer_handle);
     }
 
-    if (s_avi->avi_data.pbuffer != NULL) {
-        free(s_avi->avi_data.pbuffer);
+    if (handle->avi_data.pbuffer != NULL) {
+        free(handle->avi_data.pbuffer);
+    }
+    avi_index_free(&handle->avi_data.AVI_file);
+    if (handle->avi_data.state != AVI_PARSER_NONE && handle->avi_data.mode == PLAY_FILE) {
+        /*!< deinit while a file is open */
+        avi_reader_delete(handle->avi_data.file.reader);
+        close(handle->avi_data.file.avi_file);
     }
 
-    if (s_avi->event_group != NULL) {
-        vEventGroupDelete(s_avi->event_group);
+    if (handle->event_group != NULL) {
+        vEventGroupDelete(handle->event_group);
     }
 
-    free(s_avi);
-    s_avi = NULL;
+    free(handle);
     return ESP_OK;
 }
@@ -0,0 +1,288 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_check.h"
+#include "esp_timer.h"
+
+#include "avi_reader.h"
+
+static const char *TAG = "avi reader";
+
+#define READER_ALIGN   4096  /*!< file offsets of the reads are aligned to this, a multiple of the sector size */
+
+struct avi_reader_t {
+    int fd;
+    uint8_t *ring;
+    size_t ring_size;
+    size_t block_size;
+    size_t head;                 /*!< ring index the reader task writes to */
+    size_t tail;                 /*!< ring index the demuxer reads from */
+    size_t fill;                 /*!< bytes buffered between tail and head */
+    uint64_t base;               /*!< file offset of the byte at tail */
+    uint64_t skip;               /*!< bytes after base to drop before returning data */
+    uint64_t file_pos;           /*!< file offset of the next read issued by the task */
+    uint32_t generation;         /*!< bumped on every flush so that a read in flight is discarded */
+    uint64_t read_bytes;         /*!< bytes returned by read() since the reader was created */
+    uint64_t read_time_us;       /*!< time spent in those read() calls */
+    bool eof;
+    bool stop;
+    SemaphoreHandle_t lock;
+    SemaphoreHandle_t data_ready; /*!< given when data is appended or eof is reached */
+    SemaphoreHandle_t space_ready; /*!< given when data is consumed, flushed or the task should stop */
+    SemaphoreHandle_t task_done;
+};
+
+bool avi_lseek64(int fd, uint64_t offset)
+{
+    uint64_t remaining = offset;
+    int whence = SEEK_SET;
+    while (sizeof(off_t) < sizeof(uint64_t) && remaining > INT32_MAX) {
+        if (lseek(fd, INT32_MAX, whence) == (off_t) -1) {
+            return false;
+        }
+        remaining -= INT32_MAX;
+        whence = SEEK_CUR;
+    }
+    return lseek(fd, (off_t)remaining, whence) != (off_t) -1;
+}
+
+static void reader_lock(avi_reader_handle_t reader)
+{
+    xSemaphoreTake(reader->lock, portMAX_DELAY);
+}
+
+static void reader_unlock(avi_reader_handle_t reader)
+{
+    xSemaphoreGive(reader->lock);
+}
+
+/*!< must be called with the lock held */
+static void reader_flush(avi_reader_handle_t reader, uint64_t offset)
+{
+    uint64_t aligned = offset & ~((uint64_t)READER_ALIGN - 1);
+    reader->generation++;
+    reader->head = 0;
+    reader->tail = 0;
+    reader->fill = 0;
+    reader->base = aligned;
+    reader->skip = offset - aligned;
+    reader->file_pos = aligned;
+    reader->eof = false;
+    xSemaphoreGive(reader->space_ready);
+}
+
+/*!< must be called with the lock held, drops up to `size` bytes at tail */
+static size_t reader_consume(avi_reader_handle_t reader, size_t size)
+{
+    size_t n = size < reader->fill ? size : reader->fill;
+    reader->tail = (reader->tail + n) % reader->ring_size;
+    reader->fill -= n;
+    reader->base += n;
+    if (n > 0) {
+        xSemaphoreGive(reader->space_ready);
+    }
+    return n;
+}
+
+static void avi_reader_task(void *args)
+{
+    avi_reader_handle_t reader = (avi_reader_handle_t)args;
+    uint64_t fd_pos = UINT64_MAX;
+
+    reader_lock(reader);
+    while (!reader->stop) {
+        if (reader->eof || reader->ring_size - reader->fill < reader->block_size) {
+            reader_unlock(reader);
+            xSemaphoreTake(reader->space_ready, portMAX_DELAY);
+            reader_lock(reader);
+            continue;
+        }
+        uint32_t generation = reader->generation;
+        uint64_t pos = reader->file_pos;
+        uint8_t *dst = reader->ring + reader->head;
+        size_t size = reader->block_size;
+        reader_unlock(reader);
+
+        /*!< the ring is a multiple of block_size and head only moves by whole blocks, so dst is contiguous */
+        ssize_t ret = -1;
+        int64_t start = esp_timer_get_time();
+        if (pos == fd_pos || avi_lseek64(reader->fd, pos)) {
+            ret = read(reader->fd, dst, size);
+        }
+        int64_t elapsed = esp_timer_get_time() - start;
+        fd_pos = ret > 0 ? pos + ret : UINT64_MAX;
+
+        reader_lock(reader);
+        if (ret > 0) {
+            reader->read_bytes += ret;
+            reader->read_time_us += elapsed;
+        }
+        if (generation != reader->generation) {
+            continue;    /*!< flushed while reading, the data belongs to the old position */
+        }
+        if (ret > 0) {
+            reader->head = (reader->head + ret) % reader->ring_size;
+            reader->fill += ret;
+            reader->file_pos += ret;
+        }
+        if (ret != (ssize_t)size) {
+            if (ret < 0) {
+                ESP_LOGE(TAG, "read failed at %"PRIu64"", pos);
+            }
+            reader->eof = true;
+        }
+        xSemaphoreGive(reader->data_ready);
+    }
+    reader_unlock(reader);
+    xSemaphoreGive(reader->task_done);
+    vTaskDelete(NULL);
+}
+
+esp_err_t avi_reader_create(const avi_reader_config_t *config, uint64_t offset, avi_reader_handle_t *ret_reader)
+{
+    ESP_RETURN_ON_FALSE(config != NULL && ret_reader != NULL, ESP_ERR_INVALID_ARG, TAG, "invalid argument");
+    ESP_RETURN_ON_FALSE(config->block_size >= READER_ALIGN && config->block_size % READER_ALIGN == 0, ESP_ERR_INVALID_ARG,
+                        TAG, "block size must be a multiple of %d", READER_ALIGN);
+    ESP_RETURN_ON_FALSE(config->ring_size >= 2 * config->block_size, ESP_ERR_INVALID_ARG, TAG, "ring must hold two blocks");
+
+    esp_err_t ret = ESP_OK;
+    avi_reader_handle_t reader = (avi_reader_handle_t)calloc(1, sizeof(struct avi_reader_t));
+    ESP_RETURN_ON_FALSE(reader != NULL, ESP_ERR_NO_MEM, TAG, "Cannot alloc memory for reader");
+    reader->fd = config->fd;
+    reader->block_size = config->block_size;
+    reader->ring_size = config->ring_size - config->ring_size % config->block_size;
+
+    reader->ring = heap_caps_malloc(reader->ring_size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (reader->ring == NULL) {
+        reader->ring = malloc(reader->ring_size);
+    }
+    ESP_GOTO_ON_FALSE(reader->ring != NULL, ESP_ERR_NO_MEM, err, TAG, "Cannot alloc %d bytes for the ring", (int)reader->ring_size);
+
+    reader->lock = xSemaphoreCreateMutex();
+    reader->data_ready = xSemaphoreCreateBinary();
+    reader->space_ready = xSemaphoreCreateBinary();
+    reader->task_done = xSemaphoreCreateBinary();
+    ESP_GOTO_ON_FALSE(reader->lock && reader->data_ready && reader->space_ready && reader->task_done, ESP_ERR_NO_MEM, err,
+                      TAG, "Cannot create semaphores");
+
+    reader_flush(reader, offset);
+    ESP_GOTO_ON_FALSE(xTaskCreatePinnedToCore(avi_reader_task, "avi_reader", 3072, reader, config->priority, NULL,
+                                              config->coreID) == pdPASS, ESP_ERR_NO_MEM, err, TAG, "Cannot create reader task");
+    ESP_LOGD(TAG, "ring %d bytes, block %d bytes", (int)reader->ring_size, (int)reader->block_size);
+    *ret_reader = reader;
+    return ESP_OK;
+
+err:
+    if (reader->task_done) {
+        vSemaphoreDelete(reader->task_done);
+    }
+    if (reader->space_ready) {
+        vSemaphoreDelete(reader->space_ready);
+    }
+    if (reader->data_ready) {
+        vSemaphoreDelete(reader->data_ready);
+    }
+    if (reader->lock) {
+        vSemaphoreDelete(reader->lock);
+    }
+    free(reader->ring);
+    free(reader);
+    return ret;
+}
+
+void avi_reader_delete(avi_reader_handle_t reader)
+{
+    if (reader == NULL) {
+        return;
+    }
+    reader_lock(reader);
+    reader->stop = true;
+    xSemaphoreGive(reader->space_ready);
+    reader_unlock(reader);
+    xSemaphoreTake(reader->task_done, portMAX_DELAY);
+
+    vSemaphoreDelete(reader->task_done);
+    vSemaphoreDelete(reader->space_ready);
+    vSemaphoreDelete(reader->data_ready);
+    vSemaphoreDelete(reader->lock);
+    free(reader->ring);
+    free(reader);
+}
+
+size_t avi_reader_read(avi_reader_handle_t reader, void *buffer, size_t size)
+{
+    uint8_t *dst = (uint8_t *)buffer;
+    size_t total = 0;
+
+    reader_lock(reader);
+    while (total < size) {
+        if (reader->skip > 0) {
+            reader->skip -= reader_consume(reader, reader->skip < SIZE_MAX ? (size_t)reader->skip : SIZE_MAX);
+        }
+        if (reader->fill == 0 || reader->skip > 0) {
+            if (reader->eof) {
+                break;
+            }
+            reader_unlock(reader);
+            xSemaphoreTake(reader->data_ready, portMAX_DELAY);
+            reader_lock(reader);
+            continue;
+        }
+        size_t n = size - total;
+        if (n > reader->fill) {
+            n = reader->fill;
+        }
+        if (n > reader->ring_size - reader->tail) {
+            n = reader->ring_size - reader->tail;
+        }
+        /*!< the task never writes to buffered bytes, so the copy can run unlocked */
+        const uint8_t *src = reader->ring + reader->tail;
+        reader_unlock(reader);
+        memcpy(dst + total, src, n);
+        reader_lock(reader);
+        reader_consume(reader, n);
+        total += n;
+    }
+    reader_unlock(reader);
+    return total;
+}
+
+void avi_reader_get_stats(avi_reader_handle_t reader, uint64_t *bytes, uint64_t *time_us)
+{
+    reader_lock(reader);
+    *bytes = reader->read_bytes;
+    *time_us = reader->read_time_us;
+    reader_unlock(reader);
+}
+
+void avi_reader_seek(avi_reader_handle_t reader, uint64_t offset)
+{
+    reader_lock(reader);
+    if (offset >= reader->base && offset - reader->base <= reader->fill + reader->ring_size / 2) {
+        /*!< inside the window or a short hop ahead of it: drop the bytes in between as they arrive */
+        reader->skip = offset - reader->base;
+    } else {
+        reader_flush(reader, offset);
+    }
+    reader_unlock(reader);
+}
+
+uint64_t avi_reader_tell(avi_reader_handle_t reader)
+{
+    reader_lock(reader);
+    uint64_t offset = reader->base + reader->skip;
+    reader_unlock(reader);
+    return offset;
+}
@@ -4,6 +4,8 @@
  * SPDX-License-Identifier: Apache-2.0
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <inttypes.h>
 #include "esp_log.h"
@@ -11,222 +13,477 @@
 
 static const char *TAG = "avifile";
 
-#define MAKE_FOURCC(a, b, c, d) ((uint32_t)(d)<<24 | (uint32_t)(c)<<16 | (uint32_t)(b)<<8 | (uint32_t)(a))
-#define READ_WORD(a) ((uint32_t)*(a)<<24 | (uint32_t)*(a)<<16 | (uint32_t)*(a)<<8 | (uint32_t)*(a))
-
 static uint32_t _REV(uint32_t value)
 {
     return (value & 0x000000FFU) << 24 | (value & 0x0000FF00U) << 8 |
            (value & 0x00FF0000U) >> 8 | (value & 0xFF000000U) >> 24;
 }
 
-static int search_fourcc(uint32_t fourcc, const uint8_t *buffer, uint32_t length)
+static uint64_t chunk_end(uint64_t offset, uint32_t size)
 {
-    uint32_t i, j;
-    uint32_t *pdata;
-    j = length - 4;
-    for (i = 0; i < j; i++) {
-        pdata = (uint32_t*)(buffer + i);
-        if (fourcc == *pdata) {
-            return i;
-        }
+    return offset + sizeof(AVI_CHUNK_HEAD) + size + (size % 2);
+}
+
+/**
+ * @brief Read a chunk into a structure, zeroing the fields a shorter chunk does not have.
+ *
+ * @return false if the chunk is shorter than `min_size` or cannot be read
+ */
+static bool read_chunk(avi_read_cb_t read_cb, void *ctx, uint64_t offset, const AVI_CHUNK_HEAD *head,
+                       void *chunk, uint32_t chunk_size, uint32_t min_size)
+{
+    uint64_t size = (uint64_t)head->size + sizeof(AVI_CHUNK_HEAD);
+    if (size < min_size) {
+        return false;
+    }
+    memset(chunk, 0, chunk_size);
+    return read_cb(ctx, offset, chunk, size < chunk_size ? (uint32_t)size : chunk_size);
+}
+
+static void super_index_parser(avi_super_index_t *super, avi_read_cb_t read_cb, void *ctx, uint64_t offset)
+{
+    AVI_INDEX_HEAD indx;
+    if (!read_cb(ctx, offset, &indx, sizeof(AVI_INDEX_HEAD)) || indx.index_type != AVI_INDEX_OF_INDEXES ||
+            indx.longs_per_entry != 4 || sizeof(AVI_INDEX_HEAD) - sizeof(AVI_CHUNK_HEAD) +
+            (uint64_t)indx.entries_in_use * sizeof(AVI_SUPERINDEX_ENTRY) > indx.size) {
+        ESP_LOGW(TAG, "invalid super index, ignored");
+        return;
+    }
+    uint32_t count = indx.entries_in_use;
+    free(super->entries);
+    super->count = 0;
+    super->entries = malloc(count * sizeof(AVI_SUPERINDEX_ENTRY));
+    if (super->entries == NULL) {
+        return;
+    }
+    /*!< the entries are read straight into the table, there is no intermediate buffer */
+    if (!read_cb(ctx, offset + sizeof(AVI_INDEX_HEAD), super->entries, count * sizeof(AVI_SUPERINDEX_ENTRY))) {
+        ESP_LOGW(TAG, "super index truncated, ignored");
+        free(super->entries);
+        super->entries = NULL;
+        return;
+    }
+    super->count = count;
+    ESP_LOGI(TAG, "Find a super index with %"PRIu32" entries", count);
+}
+
+static int vids_strf_parser(avi_typedef *AVI_file, const AVI_STRH_CHUNK *strh, const AVI_VIDS_STRF_CHUNK *strf)
+{
+    ESP_LOGI(TAG, "Find a video stream");
+    if (MJPG_ID == strh->fourcc_codec) {
+        AVI_file->vids_format = FORMAT_MJEPG;
+    } else if (H264_ID == strh->fourcc_codec) {
+        AVI_file->vids_format = FORMAT_H264;
+    } else {
+        ESP_LOGE(TAG, "only support mjpeg\\h264 decoder, but needed is 0x%"PRIx32"", strh->fourcc_codec);
+        return -1;
+    }
+#ifdef CONFIG_AVI_PLAYER_DEBUG_INFO
+    printf("-----video strf info------\r\n");
+    printf("Size of this structure:%d\r\n", strf->size1);
+    printf("Width of image:%d\r\n", strf->width);
+    printf("Height of image:%d\r\n", strf->height);
+    printf("Number of planes:%d\r\n", strf->planes);
+    printf("Number of bits per pixel:%d\r\n", strf->bitcount);
+    printf("Compression type:0x%x\r\n", strf->fourcc_compression);
+    printf("Image size:%d\r\n", strf->image_size);
+    printf("Horizontal resolution:%d\r\n", strf->x_pixels_per_meter);
+    printf("Vertical resolution:%d\r\n", strf->y_pixels_per_meter);
+    printf("Number of colors in palette:%d\r\n", strf->num_colors);
+    printf("Number of important colors:%d\r\n\n", strf->imp_colors);
+#endif
+    AVI_file->vids_fps = strh->rate / strh->scale;
+    AVI_file->vids_scale = strh->scale;
+    AVI_file->vids_rate = strh->rate;
+    AVI_file->vids_length = strh->length;
+    AVI_file->vids_width = strf->width;
+    AVI_file->vids_height = strf->height;
+    AVI_file->vids_suggest_buff_size = strh->suggest_buff_size;
+    return 0;
+}
+
+static int auds_strf_parser(avi_typedef *AVI_file, const AVI_STRH_CHUNK *strh, const AVI_AUDS_STRF_CHUNK *strf)
+{
+    ESP_LOGI(TAG, "Find a audio stream");
+    if (0x01 == strf->format_tag) {
+        AVI_file->auds_format = FORMAT_PCM;
+    } else if (0x55 == strf->format_tag) {
+        AVI_file->auds_format = FORMAT_MP3;
+    } else {
+        ESP_LOGE(TAG, "only support pcm\\mp3 decoder, but needed is 0x%"PRIx16"", strf->format_tag);
+        return -1;
     }
-    return -1;
+#ifdef CONFIG_AVI_PLAYER_DEBUG_INFO
+    printf("-----audio strf info------\r\n");
+    printf("strf data block info(audio stream):");
+    printf("format tag:%d\r\n", strf->format_tag);
+    printf("number of channels:%d\r\n", strf->channels);
+    printf("sampling rate:%d\r\n", strf->samples_per_sec);
+    printf("bitrate:%d\r\n", strf->avg_bytes_per_sec);
+    printf("block align:%d\r\n", strf->block_align);
+    printf("sample size:%d\r\n\n", strf->bits_per_sample);
+#endif
+    AVI_file->auds_channels = strf->channels;
+    AVI_file->auds_sample_rate = strf->samples_per_sec;
+    AVI_file->auds_bits = strf->bits_per_sample;
+    if (!AVI_file->auds_bits) AVI_file->auds_bits = 16; // mp3 does not have bits_per_sample
+    AVI_file->auds_scale = strh->scale;
+    AVI_file->auds_rate = strh->rate;
+    AVI_file->auds_length = strh->length;
+    AVI_file->auds_sample_size = strh->sample_size;
+    AVI_file->auds_suggest_buff_size = strh->suggest_buff_size;
+    return 0;
 }
 
 /**
- * @brief Parse the AVI stream list (strl) from the AVI file buffer.
+ * @brief Parse the AVI stream list (strl) chunk by chunk.
  *
  * @param AVI_file Pointer to the AVI file structure.
- * @param buffer Pointer to the AVI file buffer.
- * @param length Length of the AVI file buffer.
- * @param list_length Pointer to store the length of the parsed list.
+ * @param read_cb Read callback of the AVI data.
+ * @param ctx Context of the read callback.
+ * @param offset Offset of the first chunk in the list, after the "strl" FourCC.
+ * @param end Offset of the end of the list.
  *
  * @return
  *     -  0: Success
- *     - -1: Invalid list or FourCC
+ *     - -1: Unsupported codec or read error
  *     - -5: Invalid size or FourCC for strh or strf
  */
-static int strl_parser(avi_typedef *AVI_file, const uint8_t *buffer, uint32_t length, uint32_t *list_length)
-{
-    /**
-     * TODO: how to deal with the list is not complete in the buffer
-     */
-    const uint8_t *pdata = buffer;
-    // strl(stream list), include "strh" and "strf"
-    AVI_LIST_HEAD *strl = (AVI_LIST_HEAD*)pdata;
-    if (strl->List != LIST_ID || strl->FourCC != STRL_ID) {
-        return -1;
+static int strl_parser(avi_typedef *AVI_file, avi_read_cb_t read_cb, void *ctx, uint64_t offset, uint64_t end)
+{
+    AVI_STRH_CHUNK strh;
+    bool has_strh = false;
+    avi_super_index_t *super = NULL;
+
+    /*!< "strh" then "strf", followed by optional "indx", "vprp", "strn" or "JUNK" chunks */
+    while (offset + sizeof(AVI_CHUNK_HEAD) <= end) {
+        AVI_CHUNK_HEAD chunk;
+        if (!read_cb(ctx, offset, &chunk, sizeof(AVI_CHUNK_HEAD))) {
+            return -1;
+        }
+        if (chunk.FourCC == STRH_ID) {
+            if (!read_chunk(read_cb, ctx, offset, &chunk, &strh, sizeof(AVI_STRH_CHUNK), offsetof(AVI_STRH_CHUNK, rcFrame))) {
+                return -5;
+            }
+            has_strh = true;
+#ifdef CONFIG_AVI_PLAYER_DEBUG_INFO
+            printf("-----strh info------\r\n");
+            printf("fourcc_type:0x%x\r\n", strh.fourcc_type);
+            printf("fourcc_codec:0x%x\r\n", strh.fourcc_codec);
+            printf("flags:%d\r\n", strh.flags);
+            printf("Priority:%d\r\n", strh.priority);
+            printf("Language:%d\r\n", strh.language);
+            printf("InitFrames:%d\r\n", strh.init_frames);
+            printf("Scale:%d\r\n", strh.scale);
+            printf("Rate:%d\r\n", strh.rate);
+            printf("Start:%d\r\n", strh.start);
+            printf("Length:%d\r\n", strh.length);
+            printf("RefBufSize:%d\r\n", strh.suggest_buff_size);
+            printf("Quality:%d\r\n", strh.quality);
+            printf("SampleSize:%d\r\n", strh.sample_size);
+            printf("FrameLeft:%d\r\n", strh.rcFrame.left);
+            printf("FrameTop:%d\r\n", strh.rcFrame.top);
+            printf("FrameRight:%d\r\n", strh.rcFrame.right);
+            printf("FrameBottom:%d\r\n\n", strh.rcFrame.bottom);
+#endif
+        } else if (chunk.FourCC == STRF_ID && has_strh) {
+            int ret = 0;
+            if (VIDS_ID == strh.fourcc_type) {
+                AVI_VIDS_STRF_CHUNK strf;
+                if (!read_chunk(read_cb, ctx, offset, &chunk, &strf, sizeof(AVI_VIDS_STRF_CHUNK), offsetof(AVI_VIDS_STRF_CHUNK, planes))) {
+                    return -5;
+                }
+                ret = vids_strf_parser(AVI_file, &strh, &strf);
+                super = &AVI_file->vids_super;
+            } else if (AUDS_ID == strh.fourcc_type) {
+                AVI_AUDS_STRF_CHUNK strf;
+                if (!read_chunk(read_cb, ctx, offset, &chunk, &strf, sizeof(AVI_AUDS_STRF_CHUNK), offsetof(AVI_AUDS_STRF_CHUNK, bits_per_sample))) {
+                    ESP_LOGE(TAG, "strf size=%"PRIu32"|%d", chunk.size, sizeof(AVI_AUDS_STRF_CHUNK));
+                    return -5;
+                }
+                ret = auds_strf_parser(AVI_file, &strh, &strf);
+                super = &AVI_file->auds_super;
+            } else {
+                ESP_LOGW(TAG, "Unsupported stream 0x%"PRIx32"", strh.fourcc_type);
+            }
+            if (ret < 0) {
+                return ret;
+            }
+        } else if (chunk.FourCC == INDX_ID && super) {
+            super_index_parser(super, read_cb, ctx, offset);
+        }
+        offset = chunk_end(offset, chunk.size);
     }
-    pdata += sizeof(AVI_LIST_HEAD);
-    *list_length = strl->size + 8; //return the entire size of list
+    return has_strh ? 0 : -5;
+}
+
+/**
+ * @brief Parse the header list (hdrl): "avih", then one "strl" list per stream. "odml" and "JUNK" are skipped.
+ */
+static int hdrl_parser(avi_typedef *AVI_file, avi_read_cb_t read_cb, void *ctx, uint64_t offset, uint64_t end)
+{
+    AVI_AVIH_CHUNK avih;
+    AVI_CHUNK_HEAD chunk;
 
-    // strh
-    AVI_STRH_CHUNK *strh = (AVI_STRH_CHUNK*)pdata;
-    if (strh->FourCC != STRH_ID || strh->size + 8 != sizeof(AVI_STRH_CHUNK)) {
+    /*!< avih chunk */
+    if (!read_cb(ctx, offset, &chunk, sizeof(AVI_CHUNK_HEAD)) || chunk.FourCC != AVIH_ID ||
+            !read_chunk(read_cb, ctx, offset, &chunk, &avih, sizeof(AVI_AVIH_CHUNK), sizeof(AVI_AVIH_CHUNK))) {
         return -5;
     }
+    /*!< avih data block length */
+    AVI_file->avihsize = avih.size;
+    AVI_file->suggest_buff_size = avih.suggest_buff_size;
+
 #ifdef CONFIG_AVI_PLAYER_DEBUG_INFO
-    printf("-----strh info------\r\n");
-    printf("fourcc_type:0x%x\r\n", strh->fourcc_type);
-    printf("fourcc_codec:0x%x\r\n", strh->fourcc_codec);
-    printf("flags:%d\r\n", strh->flags);
-    printf("Priority:%d\r\n", strh->priority);
-    printf("Language:%d\r\n", strh->language);
-    printf("InitFrames:%d\r\n", strh->init_frames);
-    printf("Scale:%d\r\n", strh->scale);
-    printf("Rate:%d\r\n", strh->rate);
-    printf("Start:%d\r\n", strh->start);
-    printf("Length:%d\r\n", strh->length);
-    printf("RefBufSize:%d\r\n", strh->suggest_buff_size);
-    printf("Quality:%d\r\n", strh->quality);
-    printf("SampleSize:%d\r\n", strh->sample_size);
-    printf("FrameLeft:%d\r\n", strh->rcFrame.left);
-    printf("FrameTop:%d\r\n", strh->rcFrame.top);
-    printf("FrameRight:%d\r\n", strh->rcFrame.right);
-    printf("FrameBottom:%d\r\n\n", strh->rcFrame.bottom);
+    printf("-----avih info------\r\n");
+    printf("us_per_frame:%d\r\n", avih.us_per_frame);
+    printf("max_bytes_per_sec:%d\r\n", avih.max_bytes_per_sec);
+    printf("padding:%d\r\n", avih.padding);
+    printf("flags:%d\r\n", avih.flags);
+    printf("total_frames:%d\r\n", avih.total_frames);
+    printf("init_frames:%d\r\n", avih.init_frames);
+    printf("streams:%d\r\n", avih.streams);
+    printf("suggest_buff_size:%d\r\n", avih.suggest_buff_size);
+    printf("Width:%d\r\n", avih.width);
+    printf("Height:%d\r\n\n", avih.height);
 #endif
-    pdata += sizeof(AVI_STRH_CHUNK);
-
-    if (VIDS_ID == strh->fourcc_type) {
-        ESP_LOGI(TAG, "Find a video stream");
-        if (MJPG_ID == strh->fourcc_codec) {
-            AVI_file->vids_format = FORMAT_MJEPG;
-        } else if (H264_ID == strh->fourcc_codec) {
-            AVI_file->vids_format = FORMAT_H264;
-        } else {
-            ESP_LOGE(TAG, "only support mjpeg\\h264 decoder, but needed is 0x%"PRIx32"", strh->fourcc_codec);
+    offset = chunk_end(offset, chunk.size);
+
+    /*!< process all streams in turn */
+    uint32_t stream = 0;
+    while (offset + sizeof(AVI_LIST_HEAD) <= end) {
+        AVI_LIST_HEAD list;
+        if (!read_cb(ctx, offset, &list, sizeof(AVI_LIST_HEAD))) {
             return -1;
         }
-        AVI_VIDS_STRF_CHUNK *strf = (AVI_VIDS_STRF_CHUNK*)pdata;
-        if (strf->FourCC != STRF_ID || strf->size + 8 != sizeof(AVI_VIDS_STRF_CHUNK)) {
-            return -5;
-        }
-#ifdef CONFIG_AVI_PLAYER_DEBUG_INFO
-        printf("-----video strf info------\r\n");
-        printf("Size of this structure:%d\r\n", strf->size1);
-        printf("Width of image:%d\r\n", strf->width);
-        printf("Height of image:%d\r\n", strf->height);
-        printf("Number of planes:%d\r\n", strf->planes);
-        printf("Number of bits per pixel:%d\r\n", strf->bitcount);
-        printf("Compression type:0x%x\r\n", strf->fourcc_compression);
-        printf("Image size:%d\r\n", strf->image_size);
-        printf("Horizontal resolution:%d\r\n", strf->x_pixels_per_meter);
-        printf("Vertical resolution:%d\r\n", strf->y_pixels_per_meter);
-        printf("Number of colors in palette:%d\r\n", strf->num_colors);
-        printf("Number of important colors:%d\r\n\n", strf->imp_colors);
-#endif
-        AVI_file->vids_fps = strh->rate / strh->scale;
-        AVI_file->vids_width = strf->width;
-        AVI_file->vids_height = strf->height;
-        pdata += sizeof(AVI_VIDS_STRF_CHUNK);
-    } else if (AUDS_ID == strh->fourcc_type) {
-        ESP_LOGI(TAG, "Find a audio stream");
-        AVI_AUDS_STRF_CHUNK *strf = (AVI_AUDS_STRF_CHUNK*)pdata;
-        if (0x01 == strf->format_tag) {
-            AVI_file->auds_format = FORMAT_PCM;
-        } else if (0x55 == strf->format_tag) {
-            AVI_file->auds_format = FORMAT_MP3;
+        if (list.List == LIST_ID && list.FourCC == STRL_ID) {
+            int ret = strl_parser(AVI_file, read_cb, ctx, offset + sizeof(AVI_LIST_HEAD), chunk_end(offset, list.size));
+            if (0 > ret) {
+                ESP_LOGE(TAG, "strl of stream%"PRIu32" prase failed", stream);
+                return ret;
+            }
+            stream++;
         } else {
-            ESP_LOGE(TAG, "only support pcm\\mp3 decoder, but needed is 0x%"PRIx16"", strf->format_tag);
-            return -1;
+            ESP_LOGD(TAG, "skip 0x%08"PRIx32" in hdrl, %"PRIu32" bytes", list.List, list.size);
         }
-        if (strf->FourCC != STRF_ID) {
-            ESP_LOGE(TAG, "FourCC=0x%"PRIx32"|%"PRIx32", size=%"PRIu32"|%d", strf->FourCC, STRF_ID, strf->size, sizeof(AVI_AUDS_STRF_CHUNK));
-            return -5;
-        }
-#ifdef CONFIG_AVI_PLAYER_DEBUG_INFO
-        printf("-----audio strf info------\r\n");
-        printf("strf data block info(audio stream):");
-        printf("format tag:%d\r\n", strf->format_tag);
-        printf("number of channels:%d\r\n", strf->channels);
-        printf("sampling rate:%d\r\n", strf->samples_per_sec);
-        printf("bitrate:%d\r\n", strf->avg_bytes_per_sec);
-        printf("block align:%d\r\n", strf->block_align);
-        printf("sample size:%d\r\n\n", strf->bits_per_sample);
-#endif
-        AVI_file->auds_channels = strf->channels;
-        AVI_file->auds_sample_rate = strf->samples_per_sec;
-        AVI_file->auds_bits = strf->bits_per_sample;
-        if (!AVI_file->auds_bits) AVI_file->auds_bits = 16; // mp3 does not have bits_per_sample
-        pdata += sizeof(AVI_AUDS_STRF_CHUNK);
-    } else {
-        ESP_LOGW(TAG, "Unsupported stream 0x%"PRIu32"", strh->fourcc_type);
+        offset = chunk_end(offset, list.size);
+    }
+    if (stream != avih.streams) {
+        ESP_LOGW(TAG, "avih announces %"PRIu32" streams, %"PRIu32" found", avih.streams, stream);
     }
     return 0;
 }
 
-int avi_parser(avi_typedef *AVI_file, const uint8_t *buffer, uint32_t length)
+int avi_parser(avi_typedef *AVI_file, avi_read_cb_t read_cb, void *ctx)
 {
-    const uint8_t *pdata = buffer;
-    AVI_LIST_HEAD *riff = (AVI_LIST_HEAD*)pdata;
-    if (riff->List != RIFF_ID || riff->FourCC != AVI_ID) {
+    AVI_LIST_HEAD riff;
+    if (!read_cb(ctx, 0, &riff, sizeof(AVI_LIST_HEAD)) || riff.List != RIFF_ID || riff.FourCC != AVI_ID) {
         return -1;
     }
     /*!< data block length */
-    AVI_file->RIFFchunksize = riff->size;
-    pdata += sizeof(AVI_LIST_HEAD);
+    AVI_file->RIFFchunksize = riff.size;
+    AVI_file->suggest_buff_size = 0;
+    AVI_file->vids_suggest_buff_size = 0;
+    AVI_file->auds_suggest_buff_size = 0;
 
-    /*!< LIST data block length */
-    AVI_LIST_HEAD *list = (AVI_LIST_HEAD*)pdata;
-    if (list->List != LIST_ID || list->FourCC != HDRL_ID) {
+    /*!< walk the chunk headers of the RIFF, the payloads ("JUNK", "LIST INFO", ...) are never read */
+    bool has_hdrl = false;
+    uint64_t riff_end = chunk_end(0, riff.size);
+    uint64_t offset = sizeof(AVI_LIST_HEAD);
+    while (offset + sizeof(AVI_LIST_HEAD) <= riff_end) {
+        AVI_LIST_HEAD list;
+        if (!read_cb(ctx, offset, &list, sizeof(AVI_LIST_HEAD))) {
+            break;
+        }
+        if (list.List == LIST_ID && list.FourCC == HDRL_ID) {
+            /*!< LIST data block length */
+            AVI_file->LISTchunksize = list.size;
+            int ret = hdrl_parser(AVI_file, read_cb, ctx, offset + sizeof(AVI_LIST_HEAD), chunk_end(offset, list.size));
+            if (0 > ret) {
+                return ret;
+            }
+            has_hdrl = true;
+        } else if (list.List == LIST_ID && list.FourCC == MOVI_ID) {
+            if (!has_hdrl) {
+                return -3;
+            }
+            if (list.size < sizeof(uint32_t)) {
+                return -8;
+            }
+            AVI_file->movi_start = offset + sizeof(AVI_LIST_HEAD);
+            AVI_file->movi_size = list.size;
+            ESP_LOGI(TAG, "movi pos:%"PRIu64", size:%"PRIu32"", AVI_file->movi_start, AVI_file->movi_size);
+            return 0;
+        } else {
+            ESP_LOGD(TAG, "skip 0x%08"PRIx32" at %"PRIu64", %"PRIu32" bytes", list.List, offset, list.size);
+        }
+        offset = chunk_end(offset, list.size);
+    }
+    if (!has_hdrl) {
         return -3;
     }
-    AVI_file->LISTchunksize = list->size;
-    pdata += sizeof(AVI_LIST_HEAD);
+    ESP_LOGE(TAG, "can't find \"movi\" list");
+    return -7;
+}
 
-    /*!< avih chunk */
-    AVI_AVIH_CHUNK *avih = (AVI_AVIH_CHUNK*)pdata;
-    if (avih->FourCC != AVIH_ID || avih->size + 8 != sizeof(AVI_AVIH_CHUNK)) {
-        return -5;
+uint64_t avi_idx1_offset(const avi_typedef *AVI_file)
+{
+    /*!< movi_start points after the "movi" FourCC, which is counted in movi_size */
+    uint64_t offset = AVI_file->movi_start - 4 + AVI_file->movi_size;
+    return offset + (offset % 2);
+}
+
+static int index_reserve(avi_index_t *index, uint32_t capacity)
+{
+    if (capacity <= index->capacity) {
+        return 0;
     }
-    /*!< avih data block length */
-    AVI_file->avihsize = avih->size;
+    avi_index_entry_t *entries = realloc(index->entries, capacity * sizeof(avi_index_entry_t));
+    if (entries == NULL) {
+        ESP_LOGE(TAG, "Cannot alloc memory for %"PRIu32" index entries", capacity);
+        return -1;
+    }
+    index->entries = entries;
+    index->capacity = capacity;
+    return 0;
+}
 
-#ifdef CONFIG_AVI_PLAYER_DEBUG_INFO
-    printf("-----avih info------\r\n");
-    printf("us_per_frame:%d\r\n", avih->us_per_frame);
-    printf("max_bytes_per_sec:%d\r\n", avih->max_bytes_per_sec);
-    printf("padding:%d\r\n", avih->padding);
-    printf("flags:%d\r\n", avih->flags);
-    printf("total_frames:%d\r\n", avih->total_frames);
-    printf("init_frames:%d\r\n", avih->init_frames);
-    printf("streams:%d\r\n", avih->streams);
-    printf("suggest_buff_size:%d\r\n", avih->suggest_buff_size);
-    printf("Width:%d\r\n", avih->width);
-    printf("Height:%d\r\n\n", avih->height);
-#endif
+static void index_append(avi_index_t *index, uint64_t offset, uint32_t duration)
+{
+    if (index->count == index->capacity && index_reserve(index, index->capacity + index->capacity / 2 + 256) != 0) {
+        return;
+    }
+    index->entries[index->count].offset = offset;
+    index->entries[index->count].start = index->next_start;
+    index->count++;
+    index->next_start += duration;
+}
+
+static void index_shrink(avi_index_t *index)
+{
+    if (index->count == 0) {
+        free(index->entries);
+        memset(index, 0, sizeof(avi_index_t));
+        return;
+    }
+    avi_index_entry_t *entries = realloc(index->entries, index->count * sizeof(avi_index_entry_t));
+    if (entries != NULL) {
+        index->entries = entries;
+        index->capacity = index->count;
+    }
+}
 
-    pdata += sizeof(AVI_AVIH_CHUNK);
+uint32_t avi_auds_duration(const avi_typedef *AVI_file, uint32_t size)
+{
+    return AVI_file->auds_sample_size ? size / AVI_file->auds_sample_size : 1;
+}
 
-    /*!< process all streams in turn */
-    for (size_t i = 0; i < avih->streams; i++) {
-        uint32_t strl_size = 0;
-        int ret = strl_parser(AVI_file, pdata, length - (pdata - buffer), &strl_size);
-        if (0 > ret) {
-            ESP_LOGE(TAG, "strl of stream%d prase failed", i);
-            break;
-            /**
-             * TODO: how to deal this error? maybe we should search for the next strl.
-             */
+int avi_index_begin(avi_typedef *AVI_file)
+{
+    free(AVI_file->vids_index.entries);
+    free(AVI_file->auds_index.entries);
+    memset(&AVI_file->vids_index, 0, sizeof(avi_index_t));
+    memset(&AVI_file->auds_index, 0, sizeof(avi_index_t));
+    AVI_file->idx1_base = UINT32_MAX;
+    AVI_file->vids_max_chunk = 0;
+    AVI_file->auds_max_chunk = 0;
+
+    /*!< strh length is the number of frames or audio blocks, a good first guess for the table size */
+    if (index_reserve(&AVI_file->vids_index, AVI_file->vids_length) != 0 ||
+            index_reserve(&AVI_file->auds_index, AVI_file->auds_sample_size ? 0 : AVI_file->auds_length) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void avi_idx1_append(avi_typedef *AVI_file, const AVI_IDX1 *entries, uint32_t count)
+{
+    if (count == 0) {
+        return;
+    }
+    if (AVI_file->idx1_base == UINT32_MAX) {
+        /*!< offsets are relative to the "movi" FourCC, but some muxers write absolute offsets */
+        uint32_t movi_fourcc = AVI_file->movi_start - 4;
+        AVI_file->idx1_base = entries[0].chunkoffset < movi_fourcc ? movi_fourcc : 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t type = entries[i].FourCC & 0xFFFF0000;
+        uint64_t offset = (uint64_t)AVI_file->idx1_base + entries[i].chunkoffset;
+        uint32_t size = entries[i].chunklength;
+        if (type == DC_ID || type == DB_ID) {
+            index_append(&AVI_file->vids_index, offset, 1);
+            AVI_file->vids_max_chunk = size > AVI_file->vids_max_chunk ? size : AVI_file->vids_max_chunk;
+        } else if (type == WB_ID) {
+            index_append(&AVI_file->auds_index, offset, avi_auds_duration(AVI_file, size));
+            AVI_file->auds_max_chunk = size > AVI_file->auds_max_chunk ? size : AVI_file->auds_max_chunk;
         }
-        pdata += strl_size;
     }
-    int movi_offset = search_fourcc(MAKE_FOURCC('m', 'o', 'v', 'i'), pdata, length - (pdata - buffer));
-    if (0 > movi_offset) {
-        ESP_LOGE(TAG, "can't find \"movi\" list");
-        return -7;
+}
+
+void avi_ix_append(avi_typedef *AVI_file, const AVI_INDEX_HEAD *head, const AVI_STDINDEX_ENTRY *entries, uint32_t count)
+{
+    uint32_t type = head->chunk_id & 0xFFFF0000;
+
+    for (uint32_t i = 0; i < count; i++) {
+        /*!< standard index entries point at the chunk data, the frame table at the chunk header */
+        uint64_t offset = head->base_offset + entries[i].offset - sizeof(AVI_CHUNK_HEAD);
+        uint32_t size = entries[i].size & 0x7FFFFFFF;
+        if (type == DC_ID || type == DB_ID) {
+            index_append(&AVI_file->vids_index, offset, 1);
+            AVI_file->vids_max_chunk = size > AVI_file->vids_max_chunk ? size : AVI_file->vids_max_chunk;
+        } else if (type == WB_ID) {
+            index_append(&AVI_file->auds_index, offset, avi_auds_duration(AVI_file, size));
+            AVI_file->auds_max_chunk = size > AVI_file->auds_max_chunk ? size : AVI_file->auds_max_chunk;
+        }
+    }
+}
+
+void avi_index_end(avi_typedef *AVI_file)
+{
+    index_shrink(&AVI_file->vids_index);
+    index_shrink(&AVI_file->auds_index);
+    ESP_LOGI(TAG, "index loaded: %"PRIu32" video, %"PRIu32" audio entries", AVI_file->vids_index.count, AVI_file->auds_index.count);
+}
+
+void avi_index_free(avi_typedef *AVI_file)
+{
+    free(AVI_file->vids_index.entries);
+    free(AVI_file->auds_index.entries);
+    free(AVI_file->vids_super.entries);
+    free(AVI_file->auds_super.entries);
+    memset(&AVI_file->vids_index, 0, sizeof(avi_index_t));
+    memset(&AVI_file->auds_index, 0, sizeof(avi_index_t));
+    memset(&AVI_file->vids_super, 0, sizeof(avi_super_index_t));
+    memset(&AVI_file->auds_super, 0, sizeof(avi_super_index_t));
+}
+
+uint32_t avi_index_lookup(const avi_index_t *index, uint32_t start)
+{
+    uint32_t low = 0, high = index->count;
+    while (high - low > 1) {
+        uint32_t mid = low + (high - low) / 2;
+        if (index->entries[mid].start <= start) {
+            low = mid;
+        } else {
+            high = mid;
+        }
     }
-    AVI_file->movi_start = movi_offset + 4  + pdata - buffer;
-    /*!< back to the list head */
-    pdata += movi_offset - 8;
-    AVI_LIST_HEAD *movi = (AVI_LIST_HEAD*)pdata;
-    if (movi->List != LIST_ID || movi->FourCC != MOVI_ID) {
-        return -8;
+    return low;
+}
+
+int64_t avi_vids_pts_us(const avi_typedef *AVI_file, uint32_t start)
+{
+    if (AVI_file->vids_rate == 0) {
+        return 0;
     }
-    AVI_file->movi_size = movi->size;
-    pdata += sizeof(AVI_LIST_HEAD);
-    ESP_LOGI(TAG, "movi pos:%"PRIu32", size:%"PRIu32"", AVI_file->movi_start, AVI_file->movi_size);
+    return (int64_t)start * AVI_file->vids_scale * 1000000 / AVI_file->vids_rate;
+}
 
-    return 0;
+int64_t avi_auds_pts_us(const avi_typedef *AVI_file, uint32_t start)
+{
+    if (AVI_file->auds_rate == 0) {
+        return 0;
+    }
+    return (int64_t)start * AVI_file->auds_scale * 1000000 / AVI_file->auds_rate;
 }
@@ -117,4 +117,34 @@ typedef struct {
     uint32_t chunklength;
 } __attribute__((packed)) AVI_IDX1;
 
+/*!< bIndexType of the OpenDML index chunks */
+#define AVI_INDEX_OF_INDEXES 0x00
+#define AVI_INDEX_OF_CHUNKS  0x01
+
+/*!< Header shared by the OpenDML super index ("indx") and standard index ("ix##") chunks */
+typedef struct {
+    uint32_t FourCC;           /*!< Chunk ID, "indx" or "ix##" */
+    uint32_t size;             /*!< Size of the chunk, equals the size of the subsequent data */
+    uint16_t longs_per_entry;  /*!< Size of each index entry in 4-byte units */
+    uint8_t index_sub_type;    /*!< Set to 0 */
+    uint8_t index_type;        /*!< AVI_INDEX_OF_INDEXES for "indx", AVI_INDEX_OF_CHUNKS for "ix##" */
+    uint32_t entries_in_use;   /*!< Number of valid entries */
+    uint32_t chunk_id;         /*!< FourCC of the chunks this index refers to, such as "00dc" */
+    uint64_t base_offset;      /*!< Base of the entry offsets of a standard index, reserved in a super index */
+    uint32_t reserved;
+} __attribute__((packed)) AVI_INDEX_HEAD;
+
+/*!< Entry of an OpenDML super index, pointing at one standard index */
+typedef struct {
+    uint64_t offset;           /*!< Absolute file offset of the "ix##" chunk */
+    uint32_t size;             /*!< Size of the "ix##" chunk */
+    uint32_t duration;         /*!< Time span covered by the standard index, in stream ticks */
+} __attribute__((packed)) AVI_SUPERINDEX_ENTRY;
+
+/*!< Entry of an OpenDML standard index, pointing at one chunk */
+typedef struct {
+    uint32_t offset;           /*!< Offset of the chunk data relative to base_offset */
+    uint32_t size;             /*!< Size of the chunk data, bit 31 is set for non-key frames */
+} __attribute__((packed)) AVI_STDINDEX_ENTRY;
+
 #endif
@@ -69,6 +69,7 @@ typedef struct {
     uint8_t *data;                     /*!< Image data for this frame */
     size_t data_bytes;                 /*!< Size of image data buffer */
     frame_type_t type;                 /*!< Frame type: video or audio */
+    int64_t pts_us;                    /*!< Presentation time of the frame, from the rational rate of its stream */
     /**
      * @brief frame info
      *
@@ -83,13 +84,18 @@ typedef void (*video_write_cb)(frame_data_t *data, void *arg);
 typedef void (*audio_write_cb)(frame_data_t *data, void *arg);
 typedef void (*audio_set_clock_cb)(uint32_t rate, uint32_t bits_cfg, uint32_t ch, void *arg);
 typedef void (*avi_play_end_cb)(void *arg);
+typedef uint8_t *(*video_buffer_cb)(size_t size, void *arg);
+typedef uint32_t (*audio_queued_cb)(void *arg);
+typedef void (*avi_seek_done_cb)(void *arg);
+
+typedef struct avi_player_t *avi_player_handle_t;
 
 /**
  * @brief avi player config
  *
  */
 typedef struct {
-    size_t buffer_size;                      /*!< Internal buffer size */
+    size_t buffer_size;                      /*!< Maximum size of the internal buffer holding one audio or video chunk. It is sized from the index or the stream headers and kept for the next files */
     video_write_cb video_cb;                 /*!< Video frame callback */
     audio_write_cb audio_cb;                 /*!< Audio frame callback */
     audio_set_clock_cb audio_set_clock_cb;   /*!< Audio set clock callback */
@@ -97,32 +103,84 @@ typedef struct {
     UBaseType_t priority;                    /*!< FreeRTOS task priority */
     BaseType_t coreID;                       /*!< ESP32 core ID */
     void *user_data;                         /*!< User data */
+    size_t read_ahead_size;                  /*!< Read-ahead ring for file playback, e.g. 256 KB - 1 MB. 0 reads inline */
+    size_t read_ahead_block;                 /*!< Size of each read-ahead read, a multiple of 4 KB. Default 64 KB */
+    video_buffer_cb video_buffer_cb;         /*!< Optional. Returns a buffer of at least `size` bytes to read the next video frame into,
+                                                  or NULL to drop it. The buffer is passed to video_cb (data_bytes is 0 if the read failed)
+                                                  and stays owned by the caller. Video frames then bypass the internal buffer,
+                                                  so avi_player_get_video_buffer() is not served */
+    audio_queued_cb audio_queued_cb;         /*!< Optional. Returns the number of audio samples per channel handed to the output
+                                                  that it has not played yet. When set, video frames follow the audio clock,
+                                                  otherwise they follow esp_timer */
+    uint32_t late_threshold_us;              /*!< A video frame later than this is skipped without reading it. Default one frame period */
+    avi_seek_done_cb seek_done_cb;           /*!< Optional. Called on the player task once a seek is applied, before the first chunk
+                                                  from the new position. Audio handed out before it belongs to the old position */
 } avi_player_config_t;
 
+/**
+ * @brief avi player statistics, counted since the start of the current file
+ *
+ */
+typedef struct {
+    uint32_t video_frames;           /*!< Video frames handed to video_cb */
+    uint32_t video_skipped;          /*!< Late video frames skipped before their payload was read */
+    uint32_t video_dropped;          /*!< Video frames dropped because video_buffer_cb returned no buffer */
+    uint64_t bytes_read;             /*!< Chunk payload bytes read */
+    uint64_t storage_bytes;          /*!< Bytes read from the file, by the read-ahead task when there is one */
+    uint64_t storage_time_us;        /*!< Time spent in those reads, the storage throughput is storage_bytes / storage_time_us */
+} avi_player_stats_t;
+
 /**
  * @brief Plays an AVI file from memory. The buffer of the AVI will be passed through the set callback function.
  *
  * This function initializes and plays an AVI file from a memory buffer.
  *
+ * @param handle AVI player handle
  * @param avi_data Pointer to the AVI file data in memory.
  * @param avi_size Size of the AVI file data in bytes.
  * @return esp_err_t ESP_OK if successful, otherwise an error code.
  */
-esp_err_t avi_player_play_from_memory(uint8_t *avi_data, size_t avi_size);
+esp_err_t avi_player_play_from_memory(avi_player_handle_t handle, uint8_t *avi_data, size_t avi_size);
 
 /**
  * @brief Plays an AVI file from the filesystem. The buffer of the AVI will be passed through the set callback function.
  *
  * This function initializes and plays an AVI file from the filesystem using its filename.
  *
+ * @param handle AVI player handle
+ * @param filename Path to the AVI file on the filesystem.
+ * @return esp_err_t ESP_OK if successful, otherwise an error code.
+ */
+esp_err_t avi_player_play_from_file(avi_player_handle_t handle, const char *filename);
+
+/**
+ * @brief Open an AVI file and get it ready to play without delivering any frame.
+ *
+ * The header is parsed, the index is loaded and the read-ahead starts buffering the first frames,
+ * so that avi_player_play_prepared() starts without a stall. Use a second player instance to
+ * prepare the next file of a playlist while the current one plays.
+ *
+ * @param handle AVI player handle
  * @param filename Path to the AVI file on the filesystem.
  * @return esp_err_t ESP_OK if successful, otherwise an error code.
  */
-esp_err_t avi_player_play_from_file(const char *filename);
+esp_err_t avi_player_prepare_from_file(avi_player_handle_t handle, const char *filename);
+
+/**
+ * @brief Start playing a file opened with avi_player_prepare_from_file()
+ *
+ * @param[in] handle AVI player handle
+ *
+ * @return
+ *      - ESP_OK: Playback requested, it starts as soon as the header is parsed
+ *      - ESP_ERR_INVALID_STATE: No file prepared
+ */
+esp_err_t avi_player_play_prepared(avi_player_handle_t handle);
 
 /**
  * @brief Get one video frame from AVI stream
  *
+ * @param[in] handle AVI player handle
  * @param[out] buffer        Pointer to external buffer to hold one frame
  * @param[in,out] buffer_size Size of external buffer
  * @param[out] info          Information of the video frame
@@ -134,11 +192,12 @@ esp_err_t avi_player_play_from_file(const char *filename);
  *      - ESP_ERR_INVALID_ARG  NULL arguments
  *      - ESP_ERR_NO_MEM  External buffer not enough
  */
-esp_err_t avi_player_get_video_buffer(void **buffer, size_t *buffer_size, video_frame_info_t *info, TickType_t ticks_to_wait);
+esp_err_t avi_player_get_video_buffer(avi_player_handle_t handle, void **buffer, size_t *buffer_size, video_frame_info_t *info, TickType_t ticks_to_wait);
 
 /**
  * @brief Get the audio buffer from AVI file
  *
+ * @param[in] handle AVI player handle
  * @param[out] buffer pointer to the audio buffer
  * @param[in] buffer_size size of the audio buffer
  * @param[out] info audio frame information
@@ -150,37 +209,86 @@ esp_err_t avi_player_get_video_buffer(void **buffer, size_t *buffer_size, video_
  *      - ESP_ERR_INVALID_ARG if buffer or info is NULL or buffer_size is zero
  *      - ESP_ERR_NO_MEM if buffer size is not enough
  */
-esp_err_t avi_player_get_audio_buffer(void **buffer, size_t *buffer_size, audio_frame_info_t *info, TickType_t ticks_to_wait);
+esp_err_t avi_player_get_audio_buffer(avi_player_handle_t handle, void **buffer, size_t *buffer_size, audio_frame_info_t *info, TickType_t ticks_to_wait);
 
 /**
  * @brief Stop AVI player
  *
+ * @param[in] handle AVI player handle
+ *
  * @return
  *      - ESP_OK: Stop AVI player successfully
  *      - ESP_ERR_INVALID_STATE: AVI player not playing
  */
-esp_err_t avi_player_play_stop(void);
+esp_err_t avi_player_play_stop(avi_player_handle_t handle);
+
+/**
+ * @brief Seek the AVI player to a presentation time
+ *
+ * Playback jumps to the video chunk nearest to `pts_us` using the index of the file ("idx1" or OpenDML),
+ * and the audio stream resumes at the chunk matching that video frame.
+ *
+ * @param[in] handle AVI player handle
+ * @param[in] pts_us Target presentation time in microseconds
+ *
+ * @return
+ *      - ESP_OK: Seek request queued
+ *      - ESP_ERR_INVALID_STATE: AVI player not playing
+ *      - ESP_ERR_NOT_SUPPORTED: AVI file has no index
+ */
+esp_err_t avi_player_seek(avi_player_handle_t handle, int64_t pts_us);
+
+/**
+ * @brief Get the playback clock, the presentation time that should be on screen now
+ *
+ * Useful to drop frames that became late further down the pipeline, e.g. before decoding them.
+ *
+ * @param[in] handle AVI player handle
+ * @param[out] pts_us Current presentation time in microseconds
+ *
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: pts_us is NULL
+ *      - ESP_ERR_INVALID_STATE: AVI player not playing
+ */
+esp_err_t avi_player_get_clock(avi_player_handle_t handle, int64_t *pts_us);
+
+/**
+ * @brief Get the frame counters of the current file
+ *
+ * @param[in] handle AVI player handle
+ * @param[out] stats Counters
+ *
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: stats is NULL
+ */
+esp_err_t avi_player_get_stats(avi_player_handle_t handle, avi_player_stats_t *stats);
 
 /**
  * @brief Initialize the AVI player
  *
+ * Each call creates an independent player with its own task, so several files can be open at the same time.
+ *
  * @param[in] config Configuration of AVI player
+ * @param[out] handle Created AVI player
  *
  * @return
  *      - ESP_OK: succeed
+ *      - ESP_ERR_INVALID_ARG: handle is NULL
  *      - ESP_ERR_NO_MEM: Cannot allocate memory for AVI player
- *      - ESP_ERR_INVALID_STATE: AVI player has already been initialized
  */
-esp_err_t avi_player_init(avi_player_config_t config);
+esp_err_t avi_player_init(avi_player_config_t config, avi_player_handle_t *handle);
 
 /**
  * @brief Deinitializes the AVI player.
  *
  * This function deinitializes and cleans up resources used by the AVI player.
  *
+ * @param handle AVI player handle
  * @return esp_err_t ESP_OK if successful, otherwise an error code.
  */
-esp_err_t avi_player_deinit(void);
+esp_err_t avi_player_deinit(avi_player_handle_t handle);
 
 #ifdef __cplusplus
 }
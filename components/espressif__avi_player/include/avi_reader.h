@@ -0,0 +1,116 @@
+/*
+ * SPDX-FileCopyrightText: 2024 Espressif Systems (Shanghai) CO LTD
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __AVI_READER_H
+#define __AVI_READER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct avi_reader_t *avi_reader_handle_t;
+
+/**
+ * @brief avi reader config
+ *
+ */
+typedef struct {
+    int fd;                    /*!< File descriptor to read from, owned by the caller */
+    size_t ring_size;          /*!< Size of the read-ahead ring, rounded down to a multiple of block_size */
+    size_t block_size;         /*!< Size of each read issued to the file system */
+    UBaseType_t priority;      /*!< FreeRTOS priority of the reader task */
+    BaseType_t coreID;         /*!< ESP32 core ID of the reader task */
+} avi_reader_config_t;
+
+/**
+ * @brief Seek a file descriptor to a 64-bit offset.
+ *
+ * off_t may be 32-bit, so offsets past 2 GB are reached in steps relative to the current position.
+ *
+ * @param fd File descriptor
+ * @param offset Absolute offset from the start of the file
+ *
+ * @return
+ *      - true: Success
+ *      - false: lseek failed
+ */
+bool avi_lseek64(int fd, uint64_t offset);
+
+/**
+ * @brief Create a read-ahead reader and start its task at the given offset.
+ *
+ * The task fills a PSRAM ring with large sequential reads aligned to the file system sectors,
+ * so storage stalls are absorbed by the ring instead of the caller.
+ *
+ * @param[in] config Configuration of the reader
+ * @param[in] offset File offset to start reading at
+ * @param[out] ret_reader Created reader
+ *
+ * @return
+ *      - ESP_OK: Success
+ *      - ESP_ERR_INVALID_ARG: Invalid configuration
+ *      - ESP_ERR_NO_MEM: Cannot allocate the ring or the task
+ */
+esp_err_t avi_reader_create(const avi_reader_config_t *config, uint64_t offset, avi_reader_handle_t *ret_reader);
+
+/**
+ * @brief Stop the reader task and release the ring. The file descriptor is not closed.
+ *
+ * @param reader Reader to delete
+ */
+void avi_reader_delete(avi_reader_handle_t reader);
+
+/**
+ * @brief Read bytes at the current position, blocking until they are buffered.
+ *
+ * @param reader Reader
+ * @param[out] buffer Destination buffer
+ * @param size Number of bytes to read
+ *
+ * @return Number of bytes read, less than `size` at the end of the file or on a read error
+ */
+size_t avi_reader_read(avi_reader_handle_t reader, void *buffer, size_t size);
+
+/**
+ * @brief Move the current position.
+ *
+ * Buffered data is reused when the new position is inside or shortly after the ring window,
+ * otherwise the ring is flushed and the reader restarts at the new position.
+ *
+ * @param reader Reader
+ * @param offset Absolute file offset
+ */
+void avi_reader_seek(avi_reader_handle_t reader, uint64_t offset);
+
+/**
+ * @brief Get the current position.
+ *
+ * @param reader Reader
+ *
+ * @return Absolute file offset of the next byte returned by avi_reader_read()
+ */
+uint64_t avi_reader_tell(avi_reader_handle_t reader);
+
+/**
+ * @brief Get what the reader task read from the file so far.
+ *
+ * @param reader Reader
+ * @param[out] bytes Bytes returned by read() since the reader was created
+ * @param[out] time_us Time spent in those read() calls, the storage throughput is bytes / time_us
+ */
+void avi_reader_get_stats(avi_reader_handle_t reader, uint64_t *bytes, uint64_t *time_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -7,6 +7,7 @@
 #ifndef __AVIFILE_H
 #define __AVIFILE_H
 
+#include <stdbool.h>
 #include "avi_def.h"
 #include "avi_player.h"
 
@@ -24,6 +25,8 @@
 #define H264_ID     _REV(0x48323634)
 #define VIDS_ID     _REV(0x76696473)
 #define AUDS_ID     _REV(0x61756473)
+#define IDX1_ID     _REV(0x69647831)
+#define REC_ID      _REV(0x72656320)  /*!< "rec " list grouping the chunks to be read together */
 
 /**
 "db"：uncompressed video frame (RGB data stream);
@@ -37,6 +40,33 @@
 #define WB_ID       _REV(0x00007762)  /*!< uncompressed audio data */
 #define PC_ID       _REV(0x00007063)  /*!< use new palette */
 
+#define INDX_ID     _REV(0x696e6478)  /*!< OpenDML super index */
+#define IX_ID       _REV(0x69780000)  /*!< OpenDML standard index "ix##", compare with the low half-word */
+#define AVIX_ID     _REV(0x41564958)  /*!< OpenDML RIFF extension */
+
+/**
+ * @brief One entry of the in-memory frame table built from the index chunks.
+ *
+ * `start` is the position of the chunk in its stream, in units of strh scale/rate:
+ * the frame number for video, the block number (or sample for fixed-size samples) for audio.
+ */
+typedef struct {
+    uint64_t offset;   /*!< File offset of the chunk header */
+    uint32_t start;    /*!< Stream position of the chunk */
+} __attribute__((packed)) avi_index_entry_t;
+
+typedef struct {
+    avi_index_entry_t *entries;
+    uint32_t count;
+    uint32_t capacity;
+    uint32_t next_start;  /*!< Stream position of the next entry to append */
+} avi_index_t;
+
+typedef struct {
+    AVI_SUPERINDEX_ENTRY *entries;
+    uint32_t count;
+} avi_super_index_t;
+
 typedef struct {
     uint32_t  RIFFchunksize;
     uint32_t  LISTchunksize;
@@ -44,35 +74,164 @@ typedef struct {
     uint32_t  strlsize;
     uint32_t  strhsize;
 
-    uint32_t movi_start;
+    uint64_t movi_start;
     uint32_t movi_size;
+    uint32_t suggest_buff_size;    /*!< avih hint for a buffer holding the largest chunk of any stream, 0 if unknown */
 
     uint16_t vids_fps;
+    uint32_t vids_scale;
+    uint32_t vids_rate;
+    uint32_t vids_length;
     uint16_t vids_width;
     uint16_t vids_height;
     video_frame_format vids_format;
+    uint32_t vids_suggest_buff_size;  /*!< strh hint for a buffer holding the largest video chunk, 0 if unknown */
+    uint32_t vids_max_chunk;          /*!< Largest video chunk in the index, 0 without index */
 
     uint16_t auds_channels;
     uint16_t auds_sample_rate;
     uint16_t auds_bits;
     audio_frame_format auds_format;
+    uint32_t auds_scale;
+    uint32_t auds_rate;
+    uint32_t auds_length;
+    uint32_t auds_sample_size;
+    uint32_t auds_suggest_buff_size;  /*!< strh hint for a buffer holding the largest audio chunk, 0 if unknown */
+    uint32_t auds_max_chunk;          /*!< Largest audio chunk in the index, 0 without index */
+
+    avi_super_index_t vids_super;  /*!< OpenDML super index of the video stream */
+    avi_super_index_t auds_super;  /*!< OpenDML super index of the audio stream */
+    avi_index_t vids_index;
+    avi_index_t auds_index;
+    uint32_t idx1_base;            /*!< Base of the "idx1" chunk offsets, resolved from the first entry */
 } avi_typedef;
 
 /**
- * @brief Parse the AVI file buffer to extract essential information.
+ * @brief Read callback used by the header parser.
+ *
+ * @param ctx Context given to avi_parser().
+ * @param offset Absolute offset in the AVI data.
+ * @param buffer Destination buffer.
+ * @param size Number of bytes to read.
+ *
+ * @return true if `size` bytes were read
+ */
+typedef bool (*avi_read_cb_t)(void *ctx, uint64_t offset, void *buffer, uint32_t size);
+
+/**
+ * @brief Parse the AVI headers to extract essential information.
+ *
+ * The parser walks the chunk headers and reads only the chunks it needs. "JUNK" padding, "LIST INFO",
+ * "LIST odml" and other unknown chunks are stepped over without reading their payload, so the
+ * headers may be of any size.
  *
  * @param AVI_file Pointer to the AVI file structure.
- * @param buffer Pointer to the AVI file buffer.
- * @param length Length of the AVI file buffer.
+ * @param read_cb Callback reading the AVI data at a given offset.
+ * @param ctx Context passed to read_cb.
  *
  * @return
  *     -  0: Success
- *     - -1: Invalid RIFF or FourCC
- *     - -3: Invalid LIST or FourCC
- *     - -5: Invalid size or FourCC for avih or strf
+ *     - -1: Invalid RIFF or FourCC, unsupported codec or read error
+ *     - -3: "hdrl" list not found before "movi"
+ *     - -5: Invalid size or FourCC for avih, strh or strf
  *     - -7: "movi" list not found
  *     - -8: Invalid "movi" list
  */
-int avi_parser(avi_typedef *AVI_file, const uint8_t *buffer, uint32_t length);
+int avi_parser(avi_typedef *AVI_file, avi_read_cb_t read_cb, void *ctx);
+
+/**
+ * @brief Get the file offset of the "idx1" chunk that follows the "movi" list.
+ *
+ * @param AVI_file Pointer to the parsed AVI file structure.
+ *
+ * @return File offset of the expected "idx1" chunk header
+ */
+uint64_t avi_idx1_offset(const avi_typedef *AVI_file);
+
+/**
+ * @brief Reset the frame tables and reserve room using the stream lengths from the headers.
+ *
+ * @param AVI_file Pointer to the parsed AVI file structure.
+ *
+ * @return
+ *     -  0: Success
+ *     - -1: Cannot allocate memory for the frame tables
+ */
+int avi_index_begin(avi_typedef *AVI_file);
+
+/**
+ * @brief Append a block of "idx1" entries to the frame tables.
+ *
+ * The "idx1" chunk may be fed in several blocks, in file order.
+ *
+ * @param AVI_file Pointer to the AVI file structure.
+ * @param entries Pointer to the "idx1" entries.
+ * @param count Number of entries in the block.
+ */
+void avi_idx1_append(avi_typedef *AVI_file, const AVI_IDX1 *entries, uint32_t count);
+
+/**
+ * @brief Append a block of OpenDML standard index entries to the frame tables.
+ *
+ * @param AVI_file Pointer to the AVI file structure.
+ * @param head Header of the "ix##" chunk the entries belong to.
+ * @param entries Pointer to the standard index entries.
+ * @param count Number of entries in the block.
+ */
+void avi_ix_append(avi_typedef *AVI_file, const AVI_INDEX_HEAD *head, const AVI_STDINDEX_ENTRY *entries, uint32_t count);
+
+/**
+ * @brief Finish loading the index and shrink the frame tables to their final size.
+ *
+ * @param AVI_file Pointer to the AVI file structure.
+ */
+void avi_index_end(avi_typedef *AVI_file);
+
+/**
+ * @brief Release the frame tables and super indexes of an AVI file.
+ *
+ * @param AVI_file Pointer to the AVI file structure.
+ */
+void avi_index_free(avi_typedef *AVI_file);
+
+/**
+ * @brief Find the last entry of a frame table whose stream position is not after `start`.
+ *
+ * @param index Pointer to the frame table.
+ * @param start Stream position to look for.
+ *
+ * @return Position of the entry in the table, 0 if `start` is before the first entry
+ */
+uint32_t avi_index_lookup(const avi_index_t *index, uint32_t start);
+
+/**
+ * @brief Get the duration of an audio chunk in units of the audio time base (auds_scale / auds_rate).
+ *
+ * @param AVI_file Pointer to the AVI file structure.
+ * @param size Size of the chunk in bytes.
+ *
+ * @return Number of samples for fixed-size samples, 1 for a block of a variable bitrate stream
+ */
+uint32_t avi_auds_duration(const avi_typedef *AVI_file, uint32_t size);
+
+/**
+ * @brief Convert a video stream position (frame number) to a presentation time with the rational rate of "strh".
+ *
+ * @param AVI_file Pointer to the AVI file structure.
+ * @param start Stream position in units of vids_scale / vids_rate.
+ *
+ * @return Presentation time in microseconds
+ */
+int64_t avi_vids_pts_us(const avi_typedef *AVI_file, uint32_t start);
+
+/**
+ * @brief Convert an audio stream position to a presentation time with the rational rate of "strh".
+ *
+ * @param AVI_file Pointer to the AVI file structure.
+ * @param start Stream position in units of auds_scale / auds_rate.
+ *
+ * @return Presentation time in microseconds
+ */
+int64_t avi_auds_pts_us(const avi_typedef *AVI_file, uint32_t start);
 
 #endif
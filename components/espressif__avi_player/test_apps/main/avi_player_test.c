@@ -5,6 +5,7 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <inttypes.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -22,10 +23,45 @@ static const char *TAG = "avi_player_test";
 
 static bool end_play = false;
 
+/*!< written by the player task: where playback went after a seek and the shortest step between frames */
+static volatile bool s_seek_applied = false;
+static volatile int64_t s_pts_after_seek = -1;
+static volatile int64_t s_last_pts = -1;
+static volatile int64_t s_frame_interval = 0;
+
 void video_write(frame_data_t *data, void *arg)
 {
     TEST_ASSERT_TRUE(data->type == FRAME_TYPE_VIDEO);
     ESP_LOGI(TAG, "Video write: %d", data->data_bytes);
+    if (s_seek_applied) {
+        s_seek_applied = false;
+        s_pts_after_seek = data->pts_us;
+    } else if (s_last_pts >= 0 && data->pts_us > s_last_pts) {
+        int64_t step = data->pts_us - s_last_pts;
+        if (s_frame_interval == 0 || step < s_frame_interval) {
+            s_frame_interval = step;
+        }
+    }
+    s_last_pts = data->pts_us;
+}
+
+static void seek_done(void *arg)
+{
+    s_seek_applied = true;
+}
+
+/*!< seek and check that the first frame played afterwards is within one frame of the target */
+static void seek_and_check(avi_player_handle_t handle, int64_t target_us)
+{
+    s_pts_after_seek = -1;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_seek(handle, target_us));
+    for (int i = 0; i < 40 && s_pts_after_seek < 0; i++) {
+        vTaskDelay(50 / portTICK_PERIOD_MS);
+    }
+    ESP_LOGI(TAG, "Seek to %"PRId64" played %"PRId64", frame interval %"PRId64"", target_us, s_pts_after_seek, s_frame_interval);
+    TEST_ASSERT_TRUE(s_pts_after_seek >= 0);
+    TEST_ASSERT_TRUE(s_frame_interval > 0);
+    TEST_ASSERT_TRUE(llabs(s_pts_after_seek - target_us) <= s_frame_interval);
 }
 
 void audio_write(frame_data_t *data, void *arg)
@@ -56,14 +92,216 @@ TEST_CASE("avi_player_test", "[avi_player]")
         .avi_play_end_cb = avi_play_end,
     };
 
-    avi_player_init(config);
+    avi_player_handle_t handle;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_init(config, &handle));
+
+    avi_player_play_from_file(handle, "/spiffs/p4_introduce.avi");
+
+    while (!end_play) {
+        vTaskDelay(500 / portTICK_PERIOD_MS);
+    }
+    avi_player_deinit(handle);
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+}
+
+TEST_CASE("avi_player_seek_test", "[avi_player]")
+{
+    end_play = false;
+    s_seek_applied = false;
+    s_last_pts = -1;
+    s_frame_interval = 0;
+    avi_player_config_t config = {
+        .buffer_size = 60 * 1024,
+        .audio_cb = audio_write,
+        .video_cb = video_write,
+        .audio_set_clock_cb = audio_set_clock,
+        .avi_play_end_cb = avi_play_end,
+        .seek_done_cb = seek_done,
+    };
+
+    avi_player_handle_t handle;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_init(config, &handle));
 
-    avi_player_play_from_file("/spiffs/p4_introduce.avi");
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, avi_player_seek(handle, 0));
+    avi_player_play_from_file(handle, "/spiffs/p4_introduce.avi");
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+    /*!< forward past the frames played so far, then back before them */
+    seek_and_check(handle, 3 * 1000 * 1000);
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+    seek_and_check(handle, 1 * 1000 * 1000);
+
+    while (!end_play) {
+        vTaskDelay(500 / portTICK_PERIOD_MS);
+    }
+    avi_player_deinit(handle);
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+}
+
+/*!< play the whole file and return the stats, which stay valid after the end until the next open */
+static void play_to_end(avi_player_config_t config, avi_player_stats_t *stats)
+{
+    end_play = false;
+    avi_player_handle_t handle;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_init(config, &handle));
 
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_play_from_file(handle, "/spiffs/p4_introduce.avi"));
     while (!end_play) {
         vTaskDelay(500 / portTICK_PERIOD_MS);
     }
-    avi_player_deinit();
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_get_stats(handle, stats));
+    avi_player_deinit(handle);
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+}
+
+TEST_CASE("avi_player_read_ahead_test", "[avi_player]")
+{
+    avi_player_config_t config = {
+        .buffer_size = 60 * 1024,
+        .audio_cb = audio_write,
+        .video_cb = video_write,
+        .audio_set_clock_cb = audio_set_clock,
+        .avi_play_end_cb = avi_play_end,
+    };
+
+    /*!< the read-ahead task must hand over the same frames as inline reads */
+    avi_player_stats_t inline_stats, read_ahead_stats;
+    play_to_end(config, &inline_stats);
+    config.read_ahead_size = 256 * 1024;
+    play_to_end(config, &read_ahead_stats);
+    ESP_LOGI(TAG, "Frames inline %"PRIu32", read-ahead %"PRIu32", read-ahead storage %"PRIu64" bytes",
+             inline_stats.video_frames + inline_stats.video_skipped, read_ahead_stats.video_frames + read_ahead_stats.video_skipped,
+             read_ahead_stats.storage_bytes);
+    TEST_ASSERT_TRUE(read_ahead_stats.storage_bytes > 0);
+    TEST_ASSERT_TRUE(read_ahead_stats.video_frames > 0);
+    /*!< frames skipped for being late depend on timing, so compare every frame the player went through */
+    TEST_ASSERT_EQUAL_UINT32(inline_stats.video_frames + inline_stats.video_skipped + inline_stats.video_dropped,
+                             read_ahead_stats.video_frames + read_ahead_stats.video_skipped + read_ahead_stats.video_dropped);
+
+    end_play = false;
+    avi_player_handle_t handle;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_init(config, &handle));
+
+    avi_player_play_from_file(handle, "/spiffs/p4_introduce.avi");
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_seek(handle, 3 * 1000 * 1000));
+
+    while (!end_play) {
+        vTaskDelay(500 / portTICK_PERIOD_MS);
+    }
+    avi_player_deinit(handle);
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+}
+
+static uint8_t *s_video_buffer;
+static uint32_t s_video_buffer_calls;
+static uint32_t s_video_external_frames;
+
+static uint8_t *video_buffer(size_t size, void *arg)
+{
+    s_video_buffer_calls++;
+    return size <= 60 * 1024 ? s_video_buffer : NULL;
+}
+
+void video_write_external(frame_data_t *data, void *arg)
+{
+    TEST_ASSERT_TRUE(data->type == FRAME_TYPE_VIDEO);
+    TEST_ASSERT_TRUE(data->data == s_video_buffer);
+    s_video_external_frames++;
+    ESP_LOGI(TAG, "Video write: %d", data->data_bytes);
+}
+
+TEST_CASE("avi_player_video_buffer_test", "[avi_player]")
+{
+    end_play = false;
+    s_video_buffer_calls = 0;
+    s_video_external_frames = 0;
+    s_video_buffer = malloc(60 * 1024);
+    TEST_ASSERT_NOT_NULL(s_video_buffer);
+    avi_player_config_t config = {
+        .buffer_size = 20 * 1024,
+        .audio_cb = audio_write,
+        .video_cb = video_write_external,
+        .video_buffer_cb = video_buffer,
+        .audio_set_clock_cb = audio_set_clock,
+        .avi_play_end_cb = avi_play_end,
+    };
+
+    avi_player_handle_t handle;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_init(config, &handle));
+
+    avi_player_play_from_file(handle, "/spiffs/p4_introduce.avi");
+
+    while (!end_play) {
+        vTaskDelay(500 / portTICK_PERIOD_MS);
+    }
+    /*!< every frame fits the external buffer, so each one must have been read into it and delivered */
+    avi_player_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_get_stats(handle, &stats));
+    ESP_LOGI(TAG, "Buffer requests %"PRIu32", frames %"PRIu32", dropped %"PRIu32"", s_video_buffer_calls, stats.video_frames, stats.video_dropped);
+    TEST_ASSERT_TRUE(stats.video_frames > 0);
+    TEST_ASSERT_EQUAL_UINT32(0, stats.video_dropped);
+    TEST_ASSERT_EQUAL_UINT32(stats.video_frames, s_video_external_frames);
+    TEST_ASSERT_EQUAL_UINT32(stats.video_frames, s_video_buffer_calls);
+    avi_player_deinit(handle);
+    free(s_video_buffer);
+    vTaskDelay(500 / portTICK_PERIOD_MS);
+}
+
+/*!< ends the player whose own flag is passed as user_data */
+static void avi_play_end_flag(void *arg)
+{
+    ESP_LOGI(TAG, "Play end");
+    *(volatile bool *)arg = true;
+}
+
+static void wait_end(volatile bool *ended)
+{
+    while (!*ended) {
+        vTaskDelay(500 / portTICK_PERIOD_MS);
+    }
+}
+
+TEST_CASE("avi_player_prepare_test", "[avi_player]")
+{
+    volatile bool current_end = false;
+    volatile bool next_end = false;
+    avi_player_config_t config = {
+        .buffer_size = 60 * 1024,
+        .audio_cb = audio_write,
+        .video_cb = video_write,
+        .audio_set_clock_cb = audio_set_clock,
+        .avi_play_end_cb = avi_play_end_flag,
+        .read_ahead_size = 256 * 1024,
+    };
+
+    /*!< play one file while the next one is prepared on a second player */
+    avi_player_handle_t current, next;
+    config.user_data = (void *)&current_end;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_init(config, &current));
+    config.user_data = (void *)&next_end;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_init(config, &next));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, avi_player_play_prepared(next));
+
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_play_from_file(current, "/spiffs/p4_introduce.avi"));
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_prepare_from_file(next, "/spiffs/p4_introduce.avi"));
+    wait_end(&current_end);
+    TEST_ASSERT_FALSE(next_end);
+
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_play_prepared(next));
+    wait_end(&next_end);
+
+    /*!< start the prepared file before the player task got to parse its header */
+    current_end = false;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_prepare_from_file(current, "/spiffs/p4_introduce.avi"));
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_play_prepared(current));
+    TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, avi_player_prepare_from_file(current, "/spiffs/p4_introduce.avi"));
+    wait_end(&current_end);
+    avi_player_stats_t stats;
+    TEST_ASSERT_EQUAL(ESP_OK, avi_player_get_stats(current, &stats));
+    TEST_ASSERT_TRUE(stats.video_frames > 0);
+
+    avi_player_deinit(next);
+    avi_player_deinit(current);
     vTaskDelay(500 / portTICK_PERIOD_MS);
 }
 
@@ -2,79 +2,126 @@ fileprivate let Log = Logger(tag: "AVIPlayer")
 
 class AVIPlayer {
 
-    let videoBufferPool = Queue<UnsafeMutableBufferPointer<UInt8>>(capacity: 4)!
-    let audioDecoder: esp_audio_dec_handle_t
+    // Largest compressed video frame accepted
+    static let maxVideoFrameSize = 1024 * 1024
 
-    private var videoDataCallback: ((UnsafeMutableBufferPointer<UInt8>, Int, Size) -> Bool)? = nil
-    private var audioDataCallback: ((UnsafeMutableRawBufferPointer) -> Void)? = nil
-    private var audioSetClockCallback: ((_ sampleRate: UInt32, _ bitsPerSample: UInt8, _ channels: UInt8) -> Void)? = nil
+    // Shared by every player, a prepared player does not take buffers until it starts.
+    // The buffers start empty and grow to the frames of the stream, they are kept for the next files.
+    static let videoBufferPool: Queue<UnsafeMutableBufferPointer<UInt8>> = {
+        let pool = Queue<UnsafeMutableBufferPointer<UInt8>>(capacity: 4)!
+        for _ in 0..<4 {
+            pool.send(UnsafeMutableBufferPointer<UInt8>(start: nil, count: 0))
+        }
+        return pool
+    }()
+    let videoBufferPool = AVIPlayer.videoBufferPool
+    private var handle: avi_player_handle_t? = nil
+    let audio: AudioPipeline
+
+    private var videoDataCallback: ((UnsafeMutableBufferPointer<UInt8>, Int, Size, Int64) -> Bool)? = nil
     private var aviPlayEndCallback: (() -> Void)? = nil
-    var pcmBuffer: UnsafeMutableRawBufferPointer
+    private var pendingVideoBuffer: UnsafeMutableBufferPointer<UInt8>? = nil
+    private var readStart: Int64 = 0
+
+    /// Records the time from handing out a video buffer to the frame being read into it
+    var trace: PerfTrace? = nil
 
     private(set) var isPlaying = false
     private(set) var isPaused = false
+    private(set) var isPrepared = false
 
-    init() throws(IDF.Error) {
-        for _ in 0..<4 {
-            let buffer = IDF.JPEG.Decoder<UInt8>.allocateOutputBuffer(capacity: 1024 * 1024)!
-            videoBufferPool.send(buffer)
-        }
-
-        esp_mp3_dec_register()
-        var decoderConfig = esp_audio_dec_cfg_t()
-        decoderConfig.type = ESP_AUDIO_TYPE_MP3
-        var audioDecoder: esp_audio_dec_handle_t?
-        if esp_audio_dec_open(&decoderConfig, &audioDecoder) != ESP_AUDIO_ERR_OK {
-            throw IDF.Error(ESP_FAIL)
-        }
-        self.audioDecoder = audioDecoder!
-        pcmBuffer = Memory.allocateRaw(size: 32 * 1024, capability: .spiram)!
+    /// Audio chunks are handed to `audio`, which decodes and plays them on its own tasks
+    init(audio: AudioPipeline) throws(IDF.Error) {
+        self.audio = audio
 
         var config = avi_player_config_t()
-        config.buffer_size = 4192 * 1024
+        config.buffer_size = 256 * 1024
+        config.video_buffer_cb = { (size, arg) in
+            Unmanaged<AVIPlayer>.fromOpaque(arg!).takeUnretainedValue().videoBufferCallback(size: size)
+        }
         config.video_cb = { (data, arg) in
             Unmanaged<AVIPlayer>.fromOpaque(arg!).takeUnretainedValue().videoCallback(data: data!)
         }
         config.audio_cb = { (data, arg) in
-            Unmanaged<AVIPlayer>.fromOpaque(arg!).takeUnretainedValue().audioCallback(data: data!)
+            Unmanaged<AVIPlayer>.fromOpaque(arg!).takeUnretainedValue().audio.push(data!)
         }
         config.audio_set_clock_cb = { (rate, bits, ch, arg) in
-            Unmanaged<AVIPlayer>.fromOpaque(arg!).takeUnretainedValue().audioSetClockCallback?(rate, UInt8(bits), UInt8(ch))
+            Log.info("Audio Clock: \(rate)Hz, \(bits)-bit, \(ch) channels")
+            Unmanaged<AVIPlayer>.fromOpaque(arg!).takeUnretainedValue().audio.configure(
+                sampleRate: rate, bitsPerSample: UInt8(bits), channels: UInt8(ch)
+            )
+        }
+        config.seek_done_cb = { arg in
+            // Chunks pushed between avi_player_seek() and here are from before the seek
+            Unmanaged<AVIPlayer>.fromOpaque(arg!).takeUnretainedValue().audio.flush()
+        }
+        config.audio_queued_cb = { arg in
+            Unmanaged<AVIPlayer>.fromOpaque(arg!).takeUnretainedValue().audio.queuedFrames
         }
         config.avi_play_end_cb = { arg in
             let player = Unmanaged<AVIPlayer>.fromOpaque(arg!).takeUnretainedValue()
+            if player.isPlaying {
+                player.audio.isStreaming = false
+            }
             player.isPlaying = false
+            player.isPrepared = false
             player.aviPlayEndCallback?()
         }
         config.user_data = Unmanaged.passRetained(self).toOpaque()
         config.priority = 15
-        try IDF.Error.check(avi_player_init(config))
+        config.read_ahead_size = 1024 * 1024
+        config.read_ahead_block = 128 * 1024
+        try IDF.Error.check(avi_player_init(config, &handle))
+    }
+
+    private func videoBufferCallback(size: Int) -> UnsafeMutablePointer<UInt8>? {
+        guard var videoBuffer = videoBufferPool.receive(timeout: 0) else {
+            Log.error("Frame dropped.")
+            return nil
+        }
+        if videoBuffer.count < size {
+            // Grow with some headroom so that slightly larger frames do not reallocate again
+            let capacity = min((size + size / 4 + 0xFFFF) & ~0xFFFF, AVIPlayer.maxVideoFrameSize)
+            guard size <= capacity, let larger = IDF.JPEG.Decoder<UInt8>.allocateOutputBuffer(capacity: capacity) else {
+                Log.error("Frame too large: \(size) bytes")
+                videoBufferPool.send(videoBuffer)
+                return nil
+            }
+            free(videoBuffer.baseAddress)
+            videoBuffer = larger
+        }
+        pendingVideoBuffer = videoBuffer
+        readStart = esp_timer_get_time()
+        return videoBuffer.baseAddress
     }
 
     private func videoCallback(data: UnsafeMutablePointer<frame_data_t>) {
+        // The demuxer read the frame into the buffer handed out by videoBufferCallback
+        guard let videoBuffer = pendingVideoBuffer else {
+            return
+        }
+        pendingVideoBuffer = nil
+        trace?.record(.demux, pts: data.pointee.pts_us, start: readStart)
         while isPaused {
             Task.delay(100)
         }
-        guard let callback = videoDataCallback else {
+        guard let callback = videoDataCallback, data.pointee.data_bytes > 0 else {
+            videoBufferPool.send(videoBuffer)
             return
         }
         if data.pointee.video_info.frame_format != FORMAT_MJEPG {
             Log.error("Unsupported video format")
+            videoBufferPool.send(videoBuffer)
             return
         }
 
-        let videoBuffer = videoBufferPool.receive(timeout: 0)
-        if let videoBuffer = videoBuffer {
-            memcpy(videoBuffer.baseAddress, data.pointee.data, data.pointee.data_bytes)
-            if callback(
-                videoBuffer,
-                Int(data.pointee.data_bytes),
-                Size(width: Int(data.pointee.video_info.width), height: Int(data.pointee.video_info.height))
-            ) {
-                videoBufferPool.send(videoBuffer)
-            }
-        } else {
-            Log.error("Frame dropped.")
+        if callback(
+            videoBuffer,
+            Int(data.pointee.data_bytes),
+            Size(width: Int(data.pointee.video_info.width), height: Int(data.pointee.video_info.height)),
+            data.pointee.pts_us
+        ) {
+            videoBufferPool.send(videoBuffer)
         }
     }
 
@@ -82,74 +129,88 @@ class AVIPlayer {
         videoBufferPool.send(buffer)
     }
 
-    private func audioCallback(data: UnsafeMutablePointer<frame_data_t>) {
-        guard let callback = audioDataCallback else {
-            return
-        }
-        if data.pointee.audio_info.format == FORMAT_MP3 {
-            var input = esp_audio_dec_in_raw_t()
-            input.buffer = data.pointee.data
-            input.len = UInt32(data.pointee.data_bytes)
-            input.frame_recover = ESP_AUDIO_DEC_RECOVERY_PLC
-            var output = esp_audio_dec_out_frame_t()
-            output.buffer = pcmBuffer.assumingMemoryBound(to: UInt8.self).baseAddress!
-            output.len = UInt32(pcmBuffer.count)
-
-            let err = esp_audio_dec_process(audioDecoder, &input, &output)
-            if err != ESP_AUDIO_ERR_OK {
-                Log.error("Audio decode error: \(err)")
-                return
-            }
-
-            let audioBuffer = UnsafeMutableRawBufferPointer(
-                start: pcmBuffer.baseAddress!,
-                count: Int(output.decoded_size)
-            )
-            callback(audioBuffer)
-            return
-        } else {
-            let audioBuffer = UnsafeMutableRawBufferPointer(
-                start: data.pointee.data,
-                count: data.pointee.data_bytes
-            )
-            callback(audioBuffer)
-        }
-    }
-
-    func onVideoData(_ callback: @escaping (UnsafeMutableBufferPointer<UInt8>, Int, Size) -> Bool) {
+    func onVideoData(_ callback: @escaping (UnsafeMutableBufferPointer<UInt8>, Int, Size, Int64) -> Bool) {
         self.videoDataCallback = callback
     }
-    func onAudioData(_ callback: @escaping (UnsafeMutableRawBufferPointer) -> Void) {
-        self.audioDataCallback = callback
-    }
-    func onAudioSetClock(_ callback: @escaping (_ sampleRate: UInt32, _ bitsPerSample: UInt8, _ channels: UInt8) -> Void) {
-        self.audioSetClockCallback = callback
-    }
     func onPlayEnd(_ callback: @escaping () -> Void) {
         self.aviPlayEndCallback = callback
     }
 
+    /// Presentation time that should be on screen now, nil when not playing
+    var clock: Int64? {
+        var pts: Int64 = 0
+        return avi_player_get_clock(handle, &pts) == ESP_OK ? pts : nil
+    }
+
+    var stats: avi_player_stats_t {
+        var stats = avi_player_stats_t()
+        avi_player_get_stats(handle, &stats)
+        return stats
+    }
+
     func play(file: String) throws(IDF.Error) {
         let err = file.utf8CString.withUnsafeBufferPointer {
-            avi_player_play_from_file($0.baseAddress!)
+            avi_player_play_from_file(handle, $0.baseAddress!)
+        }
+        try IDF.Error.check(err)
+        isPaused = false
+        isPlaying = true
+        audio.isPaused = false
+        audio.isStreaming = true
+    }
+
+    /// Open the file and buffer its start without playing, start() then plays it without the open and parse delay
+    func prepare(file: String) throws(IDF.Error) {
+        let err = file.utf8CString.withUnsafeBufferPointer {
+            avi_player_prepare_from_file(handle, $0.baseAddress!)
         }
         try IDF.Error.check(err)
+        isPrepared = true
+    }
+
+    /// Throws ESP_ERR_INVALID_STATE when the prepared file failed to parse or already ended
+    func start() throws(IDF.Error) {
+        guard isPrepared else {
+            throw IDF.Error(ESP_ERR_INVALID_STATE)
+        }
+        try IDF.Error.check(avi_player_play_prepared(handle))
+        isPrepared = false
         isPaused = false
         isPlaying = true
+        audio.isPaused = false
+        audio.isStreaming = true
     }
 
+    /// The state is only changed once the demuxer accepted the stop
     func stop() throws(IDF.Error) {
-        guard isPlaying else { return }
+        guard isPlaying || isPrepared else { return }
+        try IDF.Error.check(avi_player_play_stop(handle))
+        if isPlaying {
+            audio.isStreaming = false
+            audio.isPaused = false
+            audio.flush()
+        }
         isPlaying = false
+        isPrepared = false
         isPaused = false
-        try IDF.Error.check(avi_player_play_stop())
     }
 
+    func seek(us: Int64) throws(IDF.Error) {
+        guard isPlaying else { return }
+        // The audio is flushed by seek_done_cb once the demuxer applied the seek
+        try IDF.Error.check(avi_player_seek(handle, us))
+    }
+
+    /// The audio stops with the video, the PCM already decoded waits in the pipeline for resume()
     func pause() {
         isPaused = true
+        audio.isStreaming = false
+        audio.isPaused = true
     }
 
     func resume() {
         isPaused = false
+        audio.isPaused = false
+        audio.isStreaming = true
     }
 }
@@ -0,0 +1,294 @@
+fileprivate let Log = Logger(tag: "AudioPipeline")
+
+/// Audio path decoupled from the demuxer:
+/// demuxer -> chunk queue -> decode task -> PCM ring -> writer task -> output.
+/// The demuxer only copies the chunk, it never waits for the MP3 decoder or for the I2S DMA.
+class AudioPipeline {
+    private typealias Format = (sampleRate: UInt32, bitsPerSample: UInt8, channels: UInt8)
+
+    private struct Chunk {
+        let buffer: UnsafeMutableRawBufferPointer
+        let count: Int
+        let format: audio_frame_format
+        let frames: Int
+        let generation: Int
+        // Marker with no data: the PCM before it plays in the old format, the output switches before the PCM after it
+        var newFormat: Format? = nil
+    }
+
+    private let freeChunks: Queue<UnsafeMutableRawBufferPointer>
+    private let chunks: Queue<Chunk>
+    private let pcmRing: StreamBuffer
+    private let audioDecoder: esp_audio_dec_handle_t
+    private let pcmBuffer: UnsafeMutableRawBufferPointer
+    private let writeBuffer: UnsafeMutableRawBufferPointer
+    private let lock: Semaphore
+    private let formatApplied: Semaphore
+
+    private var outputCallback: ((UnsafeMutableRawBufferPointer) -> Void)? = nil
+    private var outputQueuedCallback: (() -> UInt32)? = nil
+    private var reconfigureCallback: ((_ sampleRate: UInt32, _ bitsPerSample: UInt8, _ channels: UInt8) -> Void)? = nil
+
+    private var format: Format = (0, 0, 0)
+    private var pendingFormat: Format? = nil    // handed from the decode task to the writer task, guarded by lock
+    private var bytesPerFrame = 4
+    private var queuedChunkFrames = 0   // PCM frames of the chunks waiting for the decoder, guarded by lock
+    private var lastChunkFrames = 0     // MP3 chunks are counted as long as the last decoded one
+    private var writing = 0             // bytes taken from the ring and not handed to the output yet
+    private var generation = 0          // bumped by flush(), data of an older generation is dropped, guarded by lock
+    private var starved = true
+
+    /// Chunks dropped because the queue was full
+    private(set) var overruns = 0
+    /// Times the ring ran empty while streaming
+    private(set) var underruns = 0
+
+    /// Records the decode time of every MP3 chunk
+    var trace: PerfTrace? = nil
+
+    /// Fill level of the PCM ring in percent
+    var pcmFill: Int {
+        return pcmRing.count * 100 / pcmRing.capacity
+    }
+
+    /// Holds the PCM in the ring while set, the output only plays what the I2S DMA already has
+    var isPaused = false
+
+    /// Set while the demuxer feeds audio, the ring running empty is then an underrun
+    var isStreaming = false {
+        didSet {
+            starved = true
+        }
+    }
+
+    init(
+        ringSize: Int = 64 * 1024, chunkCount: UInt32 = 16,
+        decodeCore: BaseType_t = 0, writerCore: BaseType_t = 0, priority: UInt32 = 16
+    ) throws(IDF.Error) {
+        guard let freeChunks = Queue<UnsafeMutableRawBufferPointer>(capacity: chunkCount),
+            let chunks = Queue<Chunk>(capacity: chunkCount),
+            let pcmRing = StreamBuffer(capacity: ringSize),
+            let lock = Semaphore.createMutex(),
+            let formatApplied = Semaphore.createBinary() else {
+            throw IDF.Error(ESP_ERR_NO_MEM)
+        }
+        self.freeChunks = freeChunks
+        self.chunks = chunks
+        self.pcmRing = pcmRing
+        self.lock = lock
+        self.formatApplied = formatApplied
+        for _ in 0..<chunkCount {
+            // Grown to the chunk sizes of the stream on first use
+            freeChunks.send(UnsafeMutableRawBufferPointer(start: nil, count: 0))
+        }
+
+        esp_mp3_dec_register()
+        var decoderConfig = esp_audio_dec_cfg_t()
+        decoderConfig.type = ESP_AUDIO_TYPE_MP3
+        var audioDecoder: esp_audio_dec_handle_t?
+        if esp_audio_dec_open(&decoderConfig, &audioDecoder) != ESP_AUDIO_ERR_OK {
+            throw IDF.Error(ESP_FAIL)
+        }
+        self.audioDecoder = audioDecoder!
+        pcmBuffer = Memory.allocateRaw(size: 32 * 1024, capability: .spiram)!
+        writeBuffer = Memory.allocateRaw(size: 4 * 1024, capability: .spiram)!
+
+        Task(name: "AudioDecoder", priority: priority, xCoreID: decodeCore) { [unowned self] _ in
+            self.decodeLoop()
+        }
+        Task(name: "AudioWriter", priority: priority, xCoreID: writerCore) { [unowned self] _ in
+            self.writeLoop()
+        }
+    }
+
+    func onOutput(_ callback: @escaping (UnsafeMutableRawBufferPointer) -> Void) {
+        self.outputCallback = callback
+    }
+    /// Samples per channel written to the output but not played yet
+    func onOutputQueued(_ callback: @escaping () -> UInt32) {
+        self.outputQueuedCallback = callback
+    }
+    func onReconfigure(_ callback: @escaping (_ sampleRate: UInt32, _ bitsPerSample: UInt8, _ channels: UInt8) -> Void) {
+        self.reconfigureCallback = callback
+    }
+
+    /// Samples per channel handed to the pipeline and not played yet
+    var queuedFrames: UInt32 {
+        lock.take()
+        let frames = queuedChunkFrames
+        lock.give()
+        let bytes = pcmRing.count + writing
+        return UInt32(frames + bytes / bytesPerFrame) + (outputQueuedCallback?() ?? 0)
+    }
+
+    /// Copy an audio chunk of the demuxer, never blocks
+    @discardableResult
+    func push(_ data: UnsafeMutablePointer<frame_data_t>) -> Bool {
+        let size = data.pointee.data_bytes
+        guard size > 0 else { return true }
+        guard var buffer = freeChunks.receive(timeout: 0) else {
+            overruns += 1
+            return false
+        }
+        if buffer.count < size {
+            guard let larger = Memory.allocateRaw(size: (size + 0xFFF) & ~0xFFF, capability: .spiram) else {
+                Log.error("Cannot allocate \(size) bytes for an audio chunk")
+                freeChunks.send(buffer)
+                overruns += 1
+                return false
+            }
+            free(buffer.baseAddress)
+            buffer = larger
+        }
+        memcpy(buffer.baseAddress!, data.pointee.data, size)
+
+        let format = data.pointee.audio_info.format
+        let frames = format == FORMAT_MP3 ? lastChunkFrames : size / bytesPerFrame
+        lock.take()
+        queuedChunkFrames += frames
+        let generation = self.generation
+        lock.give()
+        chunks.send(Chunk(buffer: buffer, count: size, format: format, frames: frames, generation: generation), timeout: 0)
+        return true
+    }
+
+    /// Drop everything queued, used on seek and stop
+    func flush() {
+        lock.take()
+        generation += 1
+        lock.give()
+        var markers: [Chunk] = []
+        while let chunk = chunks.receive(timeout: 0) {
+            if chunk.newFormat != nil {
+                markers.append(chunk)
+            } else {
+                freeChunks.send(chunk.buffer)
+            }
+        }
+        // The format of the stream still changes, only its data is dropped
+        for marker in markers {
+            chunks.send(marker)
+        }
+        lock.take()
+        queuedChunkFrames = 0
+        lock.give()
+    }
+
+    private var currentGeneration: Int {
+        lock.take()
+        defer { lock.give() }
+        return generation
+    }
+
+    /// Switch the output to the format of a new stream once the audio of the previous one has played.
+    /// Only queues a marker, the demuxer goes on while the writer task drains the old audio and reconfigures.
+    func configure(sampleRate: UInt32, bitsPerSample: UInt8, channels: UInt8) {
+        if format == (sampleRate, bitsPerSample, channels) {
+            return
+        }
+        format = (sampleRate, bitsPerSample, channels)
+        bytesPerFrame = max(1, Int(bitsPerSample) / 8 * Int(channels))
+        chunks.send(Chunk(
+            buffer: UnsafeMutableRawBufferPointer(start: nil, count: 0), count: 0, format: FORMAT_PCM, frames: 0,
+            generation: currentGeneration, newFormat: format
+        ))
+    }
+
+    private func decodeLoop() {
+        for chunk in chunks {
+            if let newFormat = chunk.newFormat {
+                // Nothing of the new stream enters the ring until the writer played the old one and switched
+                lock.take()
+                pendingFormat = newFormat
+                lock.give()
+                formatApplied.take()
+                continue
+            }
+            var frames = 0
+            if chunk.generation != currentGeneration {
+                // Flushed while queued
+            } else if chunk.format == FORMAT_MP3 {
+                let start = esp_timer_get_time()
+                var input = esp_audio_dec_in_raw_t()
+                input.buffer = chunk.buffer.baseAddress!.assumingMemoryBound(to: UInt8.self)
+                input.len = UInt32(chunk.count)
+                input.frame_recover = ESP_AUDIO_DEC_RECOVERY_PLC
+                // A chunk may hold several MP3 frames
+                while input.len > 0 {
+                    var output = esp_audio_dec_out_frame_t()
+                    output.buffer = pcmBuffer.assumingMemoryBound(to: UInt8.self).baseAddress!
+                    output.len = UInt32(pcmBuffer.count)
+                    let err = esp_audio_dec_process(audioDecoder, &input, &output)
+                    if err != ESP_AUDIO_ERR_OK {
+                        Log.error("Audio decode error: \(err)")
+                        break
+                    }
+                    let decoded = Int(output.decoded_size)
+                    write(UnsafeRawBufferPointer(start: pcmBuffer.baseAddress!, count: decoded), generation: chunk.generation)
+                    frames += decoded / bytesPerFrame
+                    if input.consumed == 0 || input.consumed >= input.len {
+                        break
+                    }
+                    input.buffer += Int(input.consumed)
+                    input.len -= input.consumed
+                }
+                lastChunkFrames = frames
+                // Includes the waits for room in the ring, a full ring shows up as slow decoding
+                trace?.record(.audio, start: start)
+            } else {
+                write(UnsafeRawBufferPointer(start: chunk.buffer.baseAddress!, count: chunk.count), generation: chunk.generation)
+            }
+            lock.take()
+            queuedChunkFrames = max(0, queuedChunkFrames - chunk.frames)
+            lock.give()
+            freeChunks.send(chunk.buffer)
+        }
+    }
+
+    private func write(_ pcm: UnsafeRawBufferPointer, generation: Int) {
+        var offset = 0
+        // Blocks this task, not the demuxer, while the ring is full
+        while offset < pcm.count && generation == currentGeneration {
+            let rest = UnsafeRawBufferPointer(rebasing: pcm[offset...])
+            offset += pcmRing.send(rest, timeout: Task.ticks(100))
+        }
+    }
+
+    private func writeLoop() {
+        var seenGeneration = currentGeneration
+        while true {
+            let generation = currentGeneration
+            if seenGeneration != generation {
+                seenGeneration = generation
+                while pcmRing.receive(into: writeBuffer, timeout: 0) > 0 {}
+            }
+            if isPaused {
+                Task.delay(20)
+                continue
+            }
+            if pcmRing.isEmpty {
+                lock.take()
+                let newFormat = pendingFormat
+                pendingFormat = nil
+                lock.give()
+                if let newFormat = newFormat {
+                    reconfigureCallback?(newFormat.sampleRate, newFormat.bitsPerSample, newFormat.channels)
+                    formatApplied.give()
+                    continue
+                }
+            }
+            let count = pcmRing.receive(into: writeBuffer, timeout: Task.ticks(20))
+            if count == 0 {
+                if isStreaming && !starved {
+                    underruns += 1
+                    starved = true
+                }
+                continue
+            }
+            starved = false
+            writing = count
+            outputCallback?(UnsafeMutableRawBufferPointer(start: writeBuffer.baseAddress!, count: count))
+            writing = 0
+        }
+    }
+}
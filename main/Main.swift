@@ -20,7 +20,12 @@ func main() throws(IDF.Error) {
     }
 
     let fontPartition = IDF.Partition(type: 0x40, subtype: 0)!
-    PixelWriter.defaultFont = Font(from: fontPartition)!
+    let font = Font(from: fontPartition)!
+    if let atlasPartition = IDF.Partition(type: 0x40, subtype: 1) {
+        font.atlas = FontAtlas(from: atlasPartition, fontChecksum: font.checksum)
+    }
+    PixelWriter.defaultFont = font
+    PixelWriter.blender = try IDF.PPAClient(operType: .blend)
 
     let usbHost = USBHost()
     let mscDriver = USBHost.MSC()
@@ -45,10 +50,12 @@ func main() throws(IDF.Error) {
         }
 
         let writer = PixelWriter(buffer: frameBuffer, screenSize: tab5.display.size)
+        // Antialiased text blends with what is below, start from black on every retry
+        writer.clear(color: .black)
         writer.drawText("Storage not found.", at: Point(x: 40, y: 40), fontSize: 54, color: .white)
         writer.drawText("Please insert USB or", at: Point(x: 40, y: 114), fontSize: 54, color: .white)
         writer.drawText("SD card.", at: Point(x: 40, y: 188), fontSize: 54, color: .white)
-        tab5.display.drawBitmap(rect: Rect(origin: .zero, size: tab5.display.size), data: frameBuffer.baseAddress!)
+        tab5.display.present(frameBuffer)
 
         Task.delay(1000)
         Log.info("Retry mounting storage...")
@@ -57,37 +64,121 @@ func main() throws(IDF.Error) {
     let fileManagerView = FileManagerView(size: tab5.display.size)
     fileManagerView.push(path: "", name: mountPoint)
 
-    let aviPlayer = try AVIPlayer()
+    // MP3 decoding and I2S writes run on their own tasks, the demuxer only queues the chunks
+    let audioPipeline = try AudioPipeline(decodeCore: 0, writerCore: 0, priority: 16)
+    audioPipeline.onOutput { buffer in
+        try! tab5.audio.write(buffer)
+    }
+    audioPipeline.onOutputQueued {
+        tab5.audio.queuedFrames
+    }
+    audioPipeline.onReconfigure { sampleRate, bitsPerSample, channels in
+        try! tab5.audio.reconfigOutput(rate: sampleRate, bps: bitsPerSample, ch: channels)
+    }
+
+    // One player plays while the other prepares the next file of the directory
+    let aviPlayers = [try AVIPlayer(audio: audioPipeline), try AVIPlayer(audio: audioPipeline)]
+    var currentPlayer = 0
+    var aviPlayer: AVIPlayer {
+        return aviPlayers[currentPlayer]
+    }
+    var nextPlayer: AVIPlayer {
+        return aviPlayers[1 - currentPlayer]
+    }
     let aviPlayerSemaphore = Semaphore.createBinary()!
     var showControls = false
-    let videoBufferTx = Queue<(UnsafeMutableBufferPointer<UInt8>, Int, Size)>(capacity: 4)!
-    aviPlayer.onVideoData { buffer, bufferSize, frameSize in
-        videoBufferTx.send((buffer, bufferSize, frameSize))
-        return false
+    var stopRequested = false
+    let videoBufferTx = Queue<(UnsafeMutableBufferPointer<UInt8>, Int, Size, Int64)>(capacity: 4)!
+    for player in aviPlayers {
+        player.onVideoData { buffer, bufferSize, frameSize, pts in
+            videoBufferTx.send((buffer, bufferSize, frameSize, pts))
+            return false
+        }
+        player.onPlayEnd {
+            // A prepared player that is stopped also ends, only the playing one finishes the file
+            if player === aviPlayer {
+                aviPlayerSemaphore.give()
+            }
+        }
     }
-    aviPlayer.onAudioData { buffer in
-        try! tab5.audio.write(buffer)
+    let rect = Rect(x: 0, y: 1280 - 300, width: 720, height: 300)
+    let playerControlView = PlayerControlView(size: rect.size)
+    // Set by the touch handler, the presenter draws the controls into the next frame it shows
+    var controlsDirty = false
+    // Performance overlay in the control area while the controls are hidden
+    var showHUD = false
+    let hudView = HUDView(size: rect.size)
+    let trace = PerfTrace()!
+    audioPipeline.trace = trace
+    for player in aviPlayers {
+        player.trace = trace
     }
-    aviPlayer.onAudioSetClock { sampleRate, bitsPerSample, channels in
-        Log.info("Audio Clock: \(sampleRate)Hz, \(bitsPerSample)-bit, \(channels) channels")
-        try! tab5.audio.reconfigOutput(rate: sampleRate, bps: bitsPerSample, ch: channels)
+
+    // The video path is pipelined over three tasks so that the JPEG engine, the PPA and the DSI flush
+    // work on consecutive frames at the same time: decode N+1 | scale N | present N-1
+    // Native frames are decoded to RGB565 straight into a back framebuffer of the panel and presented by switching
+    // framebuffers. Other sizes are decoded to YUV420 into an intermediate buffer, the PPA converts them to RGB565
+    // while scaling into the back buffer, which moves 12 instead of 16 bits per decoded pixel through PSRAM twice.
+    let screenPixels = tab5.display.size.width * tab5.display.size.height
+    let decodedFrames = Queue<UnsafeMutableBufferPointer<UInt8>>(capacity: 2)!
+    for _ in 0..<2 {
+        // Allocated on the first frame that needs scaling
+        decodedFrames.send(UnsafeMutableBufferPointer(start: nil, count: 0))
     }
-    aviPlayer.onPlayEnd {
-        aviPlayerSemaphore.give()
+    // Frames with more pixels than the screen are decoded at full size, the engine cannot scale, and
+    // shrunk by the PPA. A single buffer keeps the memory at one such frame, up to 1080p.
+    let maxDecodePixels = 1920 * 1088
+    let oversizedFrames = Queue<UnsafeMutableBufferPointer<UInt8>>(capacity: 1)!
+    oversizedFrames.send(UnsafeMutableBufferPointer(start: nil, count: 0))
+    // The decoder writes whole MCUs, the rows of the decoded picture are padded to them
+    let decodeSize = { (size: Size) in Size(width: (size.width + 15) & ~15, height: (size.height + 15) & ~15) }
+    let decodePixels = { (size: Size) in decodeSize(size).width * decodeSize(size).height }
+    let yuv420Bytes = { (pixels: Int) in pixels * 3 / 2 }
+    let releaseDecodeBuffer = { (buffer: UnsafeMutableRawBufferPointer, frameSize: Size) in
+        let buffer = buffer.bindMemory(to: UInt8.self)
+        if decodePixels(frameSize) > screenPixels {
+            oversizedFrames.send(buffer)
+        } else {
+            decodedFrames.send(buffer)
+        }
     }
+    // (frame, size): a back buffer in RGB565 for native frames, else YUV420 in a decodedFrames or oversizedFrames buffer
+    let scaleTx = Queue<(UnsafeMutableRawBufferPointer, Size, Int64)>(capacity: 2)!
+    let presentTx = Queue<(UnsafeMutableBufferPointer<UInt16>, Int64)>(capacity: 2)!
+    let decodeTiming = StageTiming(trace: trace, stage: .decode)
+    let scaleTiming = StageTiming(trace: trace, stage: .scale)
+    let presentTiming = StageTiming(trace: trace, stage: .present)
+    var lateCount = 0
+    let governor = QualityGovernor()
+    // When playback ends a marker frame with no buffer is sent after the last one. Every stage passes it on and
+    // the presenter gives pipelineIdle when it arrives. A stop sets discardFrames so the queued frames are dropped.
+    var discardFrames = false
+    let pipelineIdle = Semaphore.createBinary()!
+
+    // A frame this far behind the playback clock is not decoded when a newer one is queued
+    let lateThreshold: Int64 = 50_000
     Task(name: "MJpegDecoder", priority: 15, xCoreID: 1) { _ in
-        var lastTick: UInt32? = nil
-        var frameCount = 0
-        let videoDecoder = try! IDF.JPEG.createDecoderRgb565(rgbElementOrder: .bgr, rgbConversion: .bt709)
-        let decodeBuffer1 = IDF.JPEG.Decoder<UInt16>.allocateOutputBuffer(capacity: tab5.display.size.width * tab5.display.size.height)!
-        let decodeBuffer2 = IDF.JPEG.Decoder<UInt16>.allocateOutputBuffer(capacity: tab5.display.size.width * tab5.display.size.height)!
-        let videoBuffer1 = IDF.JPEG.Decoder<UInt16>.allocateOutputBuffer(capacity: tab5.display.size.width * tab5.display.size.height)!
-        let videoBuffer2 = IDF.JPEG.Decoder<UInt16>.allocateOutputBuffer(capacity: tab5.display.size.width * tab5.display.size.height)!
-        let ppa = try! IDF.PPAClient(operType: .srm)
-        var bufferToggle = false
-        for (buffer, bufferSize, frameSize) in videoBufferTx {
-            if frameSize.width * frameSize.height > 720 * 1280 {
-                Log.error("Received video frame larger than 720x1280: \(frameSize.width)x\(frameSize.height)")
+        let rgbDecoder = try! IDF.JPEG.createDecoderRgb565(rgbElementOrder: .bgr, rgbConversion: .bt709)
+        let yuvDecoder = try! IDF.JPEG.createDecoderYuv420()
+        for (buffer, bufferSize, frameSize, pts) in videoBufferTx {
+            guard buffer.baseAddress != nil else {
+                scaleTx.send((UnsafeMutableRawBufferPointer(start: nil, count: 0), .zero, 0))
+                continue
+            }
+            if discardFrames || !governor.shouldDecode(pts: pts) {
+                aviPlayer.returnVideoBuffer(buffer)
+                continue
+            }
+            let pixels = decodePixels(frameSize)
+            if pixels > maxDecodePixels {
+                Log.error("Received video frame larger than 1920x1080: \(frameSize.width)x\(frameSize.height)")
+                aviPlayer.returnVideoBuffer(buffer)
+                continue
+            }
+            // Behind the clock with newer frames waiting: skip the decode, the next frame replaces this one anyway
+            if let clock = aviPlayer.clock, clock - pts > lateThreshold, videoBufferTx.count > 0, !aviPlayer.isPaused {
+                lateCount += 1
+                aviPlayer.returnVideoBuffer(buffer)
                 continue
             }
 
@@ -95,14 +186,189 @@ func main() throws(IDF.Error) {
                 start: buffer.baseAddress!,
                 count: bufferSize
             )
+            if frameSize == tab5.display.size {
+                let frame = tab5.display.acquireBackBuffer()!
+                do throws(IDF.Error) {
+                    try decodeTiming.measure(pts: pts) { () throws(IDF.Error) in
+                        let _ = try rgbDecoder.decode(inputBuffer: inputBuffer, outputBuffer: frame)
+                    }
+                    scaleTx.send((UnsafeMutableRawBufferPointer(frame), frameSize, pts))
+                } catch {
+                    Log.error("Failed to decode video frame: \(error)")
+                    tab5.display.releaseBackBuffer(frame)
+                }
+                aviPlayer.returnVideoBuffer(buffer)
+                continue
+            }
 
+            let pool = pixels > screenPixels ? oversizedFrames : decodedFrames
+            var decodeBuffer = pool.receive()!
+            let decodeBytes = yuv420Bytes(max(pixels, screenPixels))
+            if decodeBuffer.count < decodeBytes {
+                free(decodeBuffer.baseAddress)
+                guard let larger = IDF.JPEG.Decoder<UInt8>.allocateOutputBuffer(capacity: decodeBytes) else {
+                    Log.error("Cannot allocate a decode buffer for \(frameSize.width)x\(frameSize.height)")
+                    pool.send(UnsafeMutableBufferPointer(start: nil, count: 0))
+                    aviPlayer.returnVideoBuffer(buffer)
+                    continue
+                }
+                decodeBuffer = larger
+            }
+            do throws(IDF.Error) {
+                try decodeTiming.measure(pts: pts) { () throws(IDF.Error) in
+                    let _ = try yuvDecoder.decode(inputBuffer: inputBuffer, outputBuffer: decodeBuffer)
+                }
+                scaleTx.send((UnsafeMutableRawBufferPointer(decodeBuffer), frameSize, pts))
+            } catch {
+                Log.error("Failed to decode video frame: \(error)")
+                pool.send(decodeBuffer)
+            }
+            aviPlayer.returnVideoBuffer(buffer)
+        }
+    }
+    Task(name: "VideoScaler", priority: 15, xCoreID: 1) { _ in
+        let ppa = try! IDF.PPAClient(operType: .srm)
+        for (decodeBuffer, frameSize, pts) in scaleTx {
+            guard decodeBuffer.baseAddress != nil else {
+                presentTx.send((UnsafeMutableBufferPointer(start: nil, count: 0), 0))
+                continue
+            }
+            if discardFrames {
+                if frameSize == tab5.display.size {
+                    tab5.display.releaseBackBuffer(decodeBuffer.bindMemory(to: UInt16.self))
+                } else {
+                    releaseDecodeBuffer(decodeBuffer, frameSize)
+                }
+                continue
+            }
+            if frameSize == tab5.display.size {
+                presentTx.send((decodeBuffer.bindMemory(to: UInt16.self), pts))
+                continue
+            }
+            let videoBuffer = tab5.display.acquireBackBuffer()!
+            do throws(IDF.Error) {
+                try scaleTiming.measure(pts: pts) { () throws(IDF.Error) in
+                    let area = try ppa.fitScreen(
+                        inputBuffer: decodeBuffer.baseAddress!,
+                        inputSize: frameSize,
+                        inputPictureSize: decodeSize(frameSize),
+                        inputColorMode: .yuv420,
+                        outputBuffer: videoBuffer,
+                        outputSize: tab5.display.size,
+                        allowRotation: governor.rotates
+                    )
+                    // The back buffer still holds an older frame around the scaled picture
+                    clearOutside(area, of: videoBuffer, size: tab5.display.size)
+                }
+                presentTx.send((videoBuffer, pts))
+            } catch {
+                Log.error("Failed to scale video frame: \(error)")
+                tab5.display.releaseBackBuffer(videoBuffer)
+            }
+            releaseDecodeBuffer(decodeBuffer, frameSize)
+        }
+    }
+    Task(name: "VideoPresenter", priority: 15, xCoreID: 1) { _ in
+        var lastTick: UInt32? = nil
+        var frameCount = 0
+        var lastDemuxLost = 0
+        var lastRead = (bytes: UInt64(0), storageBytes: UInt64(0), time: UInt64(0), at: esp_timer_get_time())
+        let stripOffset = rect.minY * tab5.display.size.width
+        let stripBytes = rect.width * rect.height * MemoryLayout<UInt16>.size
+        // The controls and the HUD are blended over the full screen video by the PPA before the frame is presented
+        let blender = try! IDF.PPAClient(operType: .blend)
+        let overlayAlpha: UInt8 = 0xC0
+        // The video under the controls or the HUD, so that hiding them while paused brings it back.
+        // Saved by the PPA before each blend, the CPU does not touch the strip of every frame.
+        let underlayCopier = try! IDF.PPAClient(operType: .srm)
+        let underlay = Memory.allocateRaw(size: stripBytes, capability: [.spiram, .dma, .cacheAligned])!
+        var controlsShown = false
+        let compose = { (frame: UnsafeMutableBufferPointer<UInt16>) in
+            let overlay: UnsafeMutableBufferPointer<UInt16>? =
+                showControls ? playerControlView.buffer : showHUD ? hudView.buffer : nil
+            if let overlay = overlay {
+                do throws(IDF.Error) {
+                    try underlayCopier.copy(from: frame.baseAddress!, size: tab5.display.size, block: rect, into: underlay)
+                } catch {
+                    Log.error("Failed to save the video under the overlay: \(error)")
+                    memcpy(underlay.baseAddress!, frame.baseAddress! + stripOffset, stripBytes)
+                }
+                do throws(IDF.Error) {
+                    try blender.blend(
+                        layer: overlay.baseAddress!, layerSize: rect.size, alpha: overlayAlpha,
+                        into: frame, size: tab5.display.size, at: rect.origin
+                    )
+                } catch {
+                    Log.error("Failed to blend the overlay: \(error)")
+                    memcpy(frame.baseAddress! + stripOffset, overlay.baseAddress!, stripBytes)
+                }
+            }
+            controlsShown = overlay != nil
+        }
+        while true {
+            guard let (frame, pts) = presentTx.receive(timeout: Task.ticks(30)) else {
+                // Paused or between frames: redraw the frame on screen when the controls changed
+                if controlsDirty, aviPlayer.isPlaying, let back = tab5.display.acquireBackBuffer(timeout: 0) {
+                    controlsDirty = false
+                    let front = tab5.display.frontBuffer
+                    memcpy(back.baseAddress!, front.baseAddress!, screenPixels * MemoryLayout<UInt16>.size)
+                    if controlsShown {
+                        memcpy(back.baseAddress! + stripOffset, underlay.baseAddress!, stripBytes)
+                    }
+                    compose(back)
+                    tab5.display.present(back)
+                }
+                continue
+            }
+            guard frame.baseAddress != nil else {
+                // Nothing of the last file is left to show, the file list takes the panel
+                controlsDirty = false
+                pipelineIdle.give()
+                continue
+            }
+            if discardFrames {
+                tab5.display.releaseBackBuffer(frame)
+                continue
+            }
             frameCount += 1
             if let _lastTick = lastTick {
                 let currentTick = Task.tickCount
                 let elapsed = currentTick - _lastTick
                 if elapsed >= Task.ticks(1000) {
-                    Log.info("FPS: \(frameCount)")
+                    let stats = aviPlayer.stats
+                    Log.info("FPS: \(frameCount), late: \(lateCount), skipped: \(stats.video_skipped), dropped: \(stats.video_dropped), audio underruns: \(audioPipeline.underruns), overruns: \(audioPipeline.overruns)")
+                    // The demuxer counters are per file, a new file starts them again
+                    let demuxLost = Int(stats.video_skipped + stats.video_dropped)
+                    let lost = lateCount + max(0, demuxLost - lastDemuxLost)
+                    lastDemuxLost = demuxLost
+                    // Presenting waits for the panel, only decode and scale can fall behind
+                    governor.update(shown: frameCount, lost: lost, busiest: max(decodeTiming.average, scaleTiming.average))
+                    if stats.bytes_read < lastRead.bytes || stats.storage_bytes < lastRead.storageBytes {
+                        lastRead = (0, 0, 0, lastRead.at)
+                    }
+                    let now = esp_timer_get_time()
+                    let bytes = stats.bytes_read - lastRead.bytes
+                    // Tenths of MB/s consumed by playback, and what the storage delivers while it is read
+                    let readRate = Int64(bytes) * 10 / max(1, now - lastRead.at)
+                    let storageRate = Int64(stats.storage_bytes - lastRead.storageBytes) * 10
+                        / max(1, Int64(stats.storage_time_us - lastRead.time))
+                    lastRead = (stats.bytes_read, stats.storage_bytes, stats.storage_time_us, now)
+                    if showHUD && !showControls {
+                        var lines: [String] = []
+                        for stage in PerfTrace.Stage.allCases {
+                            if let p = trace.percentiles(of: stage) {
+                                lines.append("\(stage.name): p50 \(HUDView.ms(Int64(p.p50))) p99 \(HUDView.ms(Int64(p.p99))) ms")
+                            }
+                        }
+                        lines.append("queue: video \(videoBufferTx.count) scale \(scaleTx.count) present \(presentTx.count)")
+                        lines.append("fps \(frameCount) late \(lateCount) skipped \(stats.video_skipped) dropped \(stats.video_dropped)")
+                        lines.append("read \(readRate / 10).\(readRate % 10) MB/s (storage \(storageRate / 10).\(storageRate % 10)) pcm \(audioPipeline.pcmFill)%")
+                        lines.append("quality: \(governor.level.description)")
+                        hudView.draw(lines: lines)
+                    }
+                    Log.info("decode: \(decodeTiming.report()), scale: \(scaleTiming.report()), present: \(presentTiming.report())")
                     frameCount = 0
+                    lateCount = 0
                     lastTick = currentTick
                 }
             } else {
@@ -110,45 +376,28 @@ func main() throws(IDF.Error) {
                 lastTick = Task.tickCount
             }
 
-            do throws(IDF.Error) {
-                let decodeBuffer = bufferToggle ? decodeBuffer1 : decodeBuffer2
-                let videoBuffer = bufferToggle ? videoBuffer1 : videoBuffer2
-                let _ = try videoDecoder.decode(inputBuffer: inputBuffer, outputBuffer: decodeBuffer)
-                let draw = { () throws(IDF.Error) in
-                    let size = showControls ? Size(width: 720, height: 1280 - 300) : tab5.display.size
-                    if frameSize.width == 720 && frameSize.height == 1280 {
-                        tab5.display.drawBitmap(rect: Rect(origin: .zero, size: size), data: decodeBuffer.baseAddress!, retry: false)
-                    } else {
-                        try ppa.fitScreen(
-                            inputBuffer: decodeBuffer,
-                            inputSize: frameSize,
-                            outputBuffer: videoBuffer,
-                            outputSize: tab5.display.size
-                        )
-                        tab5.display.drawBitmap(rect: Rect(origin: .zero, size: size), data: videoBuffer.baseAddress!)
-                    }
-                }
-                try draw()
-                while aviPlayer.isPaused {
-                    Task.delay(100)
-                    try draw()
-                }
-                bufferToggle.toggle()
-            } catch {
-                Log.error("Failed to decode video frame: \(error)")
+            controlsDirty = false
+            compose(frame)
+            // Only blocks while the previous frame has not reached the panel, the back buffer is released from the refresh interrupt
+            presentTiming.measure(pts: pts) {
+                _ = tab5.display.present(frame)
             }
-            aviPlayer.returnVideoBuffer(buffer)
         }
     }
 
-    let rect = Rect(x: 0, y: 1280 - 300, width: 720, height: 300)
-    let playerControlView = PlayerControlView(size: rect.size)
-
     var selectedFile: String? = nil
+    // The list is on the panel and the presenter is idle, taps may redraw it
+    var showingList = false
     multiTouch.onEvent { event in
         guard case .tap(let point) = event else { return }
         if aviPlayer.isPlaying {
             if !showControls || point.y < 1280 - 300 {
+                if !showControls {
+                    // Ready before the presenter sees showControls
+                    playerControlView.draw(
+                        pause: !aviPlayer.isPaused, volume: tab5.audio.volume, brightness: tab5.display.brightness, hud: showHUD
+                    )
+                }
                 showControls.toggle()
                 Task.delay(30)
             } else {
@@ -156,6 +405,7 @@ func main() throws(IDF.Error) {
                 let controlEvent = playerControlView.onTap(point: point)
                 switch controlEvent {
                 case .close:
+                    stopRequested = true
                     try? aviPlayer.stop()
                     // aviPlayerSemaphore.give()
                 case .playPause:
@@ -168,23 +418,31 @@ func main() throws(IDF.Error) {
                     tab5.audio.volume = max(0, min(100, tab5.audio.volume + diff))
                 case .brightness(let diff):
                     tab5.display.brightness = max(10, min(100, tab5.display.brightness + diff))
+                case .hud:
+                    showHUD.toggle()
+                case .dumpTrace:
+                    playerControlView.dumpResult = trace.writeCSV(path: "/\(mountPoint)/trace.csv")
                 default:
                     break
                 }
             }
-            if showControls {
-                let buffer = playerControlView.draw(
-                    pause: !aviPlayer.isPaused, volume: tab5.audio.volume, brightness: tab5.display.brightness
-                )
-                tab5.display.drawBitmap(rect: rect, data: buffer.baseAddress!)
+            // Close stopped the player, the list replaces the video and there are no controls to redraw
+            if aviPlayer.isPlaying {
+                if showControls {
+                    playerControlView.draw(
+                        pause: !aviPlayer.isPaused, volume: tab5.audio.volume, brightness: tab5.display.brightness, hud: showHUD
+                    )
+                }
+                controlsDirty = true
             }
-        } else {
+        } else if showingList {
             let (refresh, file) = fileManagerView.onTouch(event: event)
             if refresh {
-                let buffer = fileManagerView.draw()
-                tab5.display.drawBitmap(rect: Rect(origin: .zero, size: fileManagerView.size), data: buffer.baseAddress!)
+                let damage = fileManagerView.draw()
+                tab5.display.drawBitmap(damage: damage, from: fileManagerView.buffer).wait()
             }
             if let file = file {
+                showingList = false
                 selectedFile = file
             }
         }
@@ -192,19 +450,28 @@ func main() throws(IDF.Error) {
 
     tab5.audio.volume = 40
     while true {
-        let buffer = fileManagerView.draw()
-        tab5.display.drawBitmap(rect: Rect(origin: .zero, size: fileManagerView.size), data: buffer.baseAddress!)
-
-        var playSucceed = false
+        fileManagerView.draw()
+        // The video covered the whole screen, the whole list is presented like a frame. Taps then copy what they
+        // redraw into the framebuffer on screen, the presenter is idle until the next file starts.
+        let listBuffer = tab5.display.acquireBackBuffer()!
+        memcpy(listBuffer.baseAddress!, fileManagerView.buffer.baseAddress!, screenPixels * MemoryLayout<UInt16>.size)
+        tab5.display.present(listBuffer).wait()
+        showingList = true
+
+        var playingFile: String? = nil
         while true {
             if let file = selectedFile {
                 Log.info("Selected file: \(file)")
                 showControls = false
-                memset(frameBuffer.baseAddress!, 0, tab5.display.size.width * tab5.display.size.height * 2)
-                tab5.display.drawBitmap(rect: Rect(origin: .zero, size: tab5.display.size), data: frameBuffer.baseAddress!)
+                stopRequested = false
+                if let back = tab5.display.acquireBackBuffer(timeout: Task.ticks(100)) {
+                    memset(back.baseAddress!, 0, back.count * MemoryLayout<UInt16>.size)
+                    tab5.display.present(back)
+                }
+                governor.reset()
                 do {
                     try aviPlayer.play(file: file)
-                    playSucceed = true
+                    playingFile = file
                 } catch {
                     Log.error("Failed to play video: \(error)")
                 }
@@ -213,10 +480,99 @@ func main() throws(IDF.Error) {
             }
             Task.delay(10)
         }
-        if !playSucceed {
-            continue
+        while let file = playingFile {
+            // Pre-roll the next video so that it starts as soon as this one ends
+            var preparedFile: String? = nil
+            if let next = fileManagerView.nextVideo(after: file) {
+                do {
+                    try nextPlayer.prepare(file: next)
+                    preparedFile = next
+                } catch {
+                    Log.error("Failed to prepare video: \(error)")
+                }
+            }
+            aviPlayerSemaphore.take()
+
+            playingFile = nil
+            guard let next = preparedFile else { break }
+            if stopRequested {
+                try? nextPlayer.stop()
+                break
+            }
+            Log.info("Next file: \(next)")
+            currentPlayer = 1 - currentPlayer
+            governor.reset()
+            do {
+                try aviPlayer.start()
+                playingFile = next
+            } catch {
+                // Nothing will end, the list is shown instead of waiting for it
+                Log.error("Failed to play video: \(error)")
+            }
+        }
+
+        // No file plays any more: hide the overlays and let the pipeline run empty before the list is drawn
+        showControls = false
+        showHUD = false
+        controlsDirty = false
+        playerControlView.dumpResult = nil
+        discardFrames = stopRequested
+        videoBufferTx.send((UnsafeMutableBufferPointer(start: nil, count: 0), 0, .zero, 0))
+        pipelineIdle.take()
+        discardFrames = false
+    }
+}
+
+/// Fill everything but `area` of a full screen buffer with black
+func clearOutside(_ area: Rect, of buffer: UnsafeMutableBufferPointer<UInt16>, size: Size) {
+    let base = buffer.baseAddress!
+    let rowBytes = size.width * MemoryLayout<UInt16>.size
+    memset(base, 0, area.minY * rowBytes)
+    memset(base + area.maxY * size.width, 0, (size.height - area.maxY) * rowBytes)
+    if area.width < size.width {
+        for y in area.minY..<area.maxY {
+            let row = base + y * size.width
+            memset(row, 0, area.minX * MemoryLayout<UInt16>.size)
+            memset(row + area.maxX, 0, (size.width - area.maxX) * MemoryLayout<UInt16>.size)
         }
-        aviPlayerSemaphore.take()
+    }
+}
+
+/// Time spent in one stage of the video pipeline, averaged over the frames since the last report
+class StageTiming {
+    private let trace: PerfTrace
+    private let stage: PerfTrace.Stage
+    private var total: Int64 = 0
+    private var count = 0
+    private var peak: Int64 = 0
+
+    init(trace: PerfTrace, stage: PerfTrace.Stage) {
+        self.trace = trace
+        self.stage = stage
+    }
+
+    /// Also recorded in the trace with the pts of the frame
+    func measure<E: Error>(pts: Int64, _ body: () throws(E) -> Void) throws(E) {
+        let start = esp_timer_get_time()
+        try body()
+        let end = esp_timer_get_time()
+        trace.record(stage, pts: pts, start: start, end: end)
+        let elapsed = end - start
+        total += elapsed
+        peak = max(peak, elapsed)
+        count += 1
+    }
+
+    var average: Int64 {
+        return count > 0 ? total / Int64(count) : 0
+    }
+
+    func report() -> String {
+        let text = "\(average / 1000).\(average % 1000 / 100)ms (max \(peak / 1000)ms)"
+        total = 0
+        count = 0
+        peak = 0
+        return text
     }
 }
 
@@ -268,25 +624,12 @@ class FileManagerView {
     private let cellHeight = 100
     private let footerHeight = 120
 
-    func draw() -> UnsafeMutableBufferPointer<UInt16> {
-        writer.clear(color: .white)
-        drawHeader(rect: Rect(x: 0, y: 0, width: size.width, height: headerHeight))
-        for i in 0..<10 {
-            let y = headerHeight + i * cellHeight
-            writer.drawLine(from: Point(x: 0, y: y), to: Point(x: size.width, y: y), color: .gray)
-            if let item = currentDirectory?.pageItem(at: i) {
-                drawCell(rect: Rect(x: 0, y: y, width: size.width, height: cellHeight), item: item)
-            }
-        }
-        drawFooter(rect: Rect(x: 0, y: size.height - footerHeight, width: size.width, height: footerHeight))
-        return buffer
-    }
-
-    private func drawHeader(rect: Rect) {
-        writer.fillRect(rect: Rect(x: rect.minX, y: rect.maxY, width: rect.width, height: 2), color: .black)
+    // What the buffer shows, only the parts that differ are drawn again
+    private var drawnTitle: String? = nil
+    private var drawnItems: [(name: String, isDirectory: Bool)?] = []
+    private var drawnPageTitle: String? = nil
 
-        let fontSize = 72
-        let leftOrigin = 40
+    private var title: String {
         var title = currentDirectory?.name ?? ""
         if directories.count == 1 {
             if title == "usb" { title = "USB Storage" }
@@ -295,6 +638,58 @@ class FileManagerView {
         if directories.count > 1 {
             title = "< " + title
         }
+        return title
+    }
+
+    private var pageTitle: String {
+        return "\((currentDirectory?.page ?? 0) + 1) / \(currentDirectory?.totalPages ?? 1)"
+    }
+
+    /// Draw what changed since the last call, returns the areas of the buffer that were drawn
+    @discardableResult
+    func draw() -> [Rect] {
+        if drawnItems.isEmpty {
+            writer.clear(color: .white)
+            writer.fillRect(rect: Rect(x: 0, y: headerHeight, width: size.width, height: 2), color: .black)
+            for i in 0..<10 {
+                let y = headerHeight + i * cellHeight
+                writer.drawLine(from: Point(x: 0, y: y), to: Point(x: size.width, y: y), color: .gray)
+            }
+            writer.fillRect(rect: Rect(x: 0, y: size.height - footerHeight, width: size.width, height: 2), color: .black)
+            drawnItems = Array(repeating: nil, count: 10)
+        }
+
+        let title = self.title
+        if title != drawnTitle {
+            drawHeader(rect: Rect(x: 0, y: 0, width: size.width, height: headerHeight), title: title)
+            drawnTitle = title
+        }
+        for i in 0..<10 {
+            let item = currentDirectory?.pageItem(at: i)
+            if item?.name == drawnItems[i]?.name && item?.isDirectory == drawnItems[i]?.isDirectory {
+                continue
+            }
+            let rect = Rect(x: 0, y: headerHeight + i * cellHeight, width: size.width, height: cellHeight)
+            // Below the separator, and below the header border for the first cell
+            writer.fillRect(rect: Rect(x: 0, y: rect.minY + 2, width: rect.width, height: rect.height - 2), color: .white)
+            if let item = item {
+                drawCell(rect: rect, item: item)
+            }
+            drawnItems[i] = item
+        }
+        let pageTitle = self.pageTitle
+        if pageTitle != drawnPageTitle {
+            drawFooter(rect: Rect(x: 0, y: size.height - footerHeight, width: size.width, height: footerHeight), pageTitle: pageTitle)
+            drawnPageTitle = pageTitle
+        }
+        return writer.damage.take()
+    }
+
+    private func drawHeader(rect: Rect, title: String) {
+        writer.fillRect(rect: rect, color: .white)
+
+        let fontSize = 72
+        let leftOrigin = 40
         writer.drawText(title,
             at: Point(x: rect.minX + leftOrigin, y: rect.minY + (rect.height - fontSize) / 2),
             fontSize: fontSize,
@@ -313,8 +708,9 @@ class FileManagerView {
         )
     }
 
-    private func drawFooter(rect: Rect) {
-        writer.fillRect(rect: Rect(x: rect.minX, y: rect.minY, width: rect.width, height: 2), color: .black)
+    private func drawFooter(rect: Rect, pageTitle: String) {
+        // Below the border
+        writer.fillRect(rect: Rect(x: rect.minX, y: rect.minY + 2, width: rect.width, height: rect.height - 2), color: .white)
 
         let fontSize = 48
         writer.drawText("<<", at: Point(x: rect.minX + 40, y: rect.minY + (rect.height - fontSize) / 2), fontSize: fontSize, color: .black)
@@ -322,7 +718,6 @@ class FileManagerView {
         let arrowWidth = PixelWriter.defaultFont!.width(of: ">>")
         writer.drawText(">>", at: Point(x: rect.maxX - arrowWidth - 40, y: rect.minY + (rect.height - fontSize) / 2), fontSize: fontSize, color: .black)
 
-        let pageTitle = "\((currentDirectory?.page ?? 0) + 1) / \(currentDirectory?.totalPages ?? 1)"
         let pageWidth = PixelWriter.defaultFont!.width(of: pageTitle)
         writer.drawText(pageTitle,
             at: Point(x: rect.center.x - pageWidth / 2, y: rect.minY + (rect.height - fontSize) / 2),
@@ -336,6 +731,22 @@ class FileManagerView {
         directories.append(directory)
     }
 
+    /// Path of the first video file listed after `file` in the current directory
+    func nextVideo(after file: String) -> String? {
+        guard let directory = currentDirectory else { return nil }
+        var found = false
+        for item in directory.items where !item.isDirectory {
+            let path = directory.path + "/" + item.name
+            if found && (item.name.hasSuffix(".avi") || item.name.hasSuffix(".AVI")) {
+                return path
+            }
+            if path == file {
+                found = true
+            }
+        }
+        return nil
+    }
+
     func onTouch(event: MultiTouch.Event) -> (refresh: Bool, file: String?) {
         guard case .tap(let point) = event else { return (false, nil) }
         if directories.isEmpty { return (false, nil) }
@@ -373,6 +784,34 @@ class FileManagerView {
     }
 }
 
+/// Performance overlay, drawn in the player control area while the controls are hidden
+class HUDView {
+    let writer: PixelWriter
+    var buffer: UnsafeMutableBufferPointer<UInt16> {
+        return writer.buffer
+    }
+
+    init(size: Size) {
+        // Cache line aligned for the PPA, which blends it over the video
+        let buffer = Memory.allocate(type: UInt16.self, capacity: size.width * size.height, capability: [.spiram, .cacheAligned])!
+        self.writer = PixelWriter(buffer: buffer, screenSize: size)
+        writer.clear(color: .black)
+    }
+
+    func draw(lines: [String]) {
+        let fontSize = 26
+        writer.clear(color: .black)
+        for (i, line) in lines.enumerated() {
+            writer.drawText(line, at: Point(x: 16, y: 12 + i * (fontSize + 4)), fontSize: fontSize, color: .green)
+        }
+    }
+
+    /// Microseconds as milliseconds with one decimal
+    static func ms(_ us: Int64) -> String {
+        return "\(us / 1000).\(us % 1000 / 100)"
+    }
+}
+
 class PlayerControlView {
     let writer: PixelWriter
     var buffer: UnsafeMutableBufferPointer<UInt16> {
@@ -385,6 +824,7 @@ class PlayerControlView {
     struct Icon {
         let offset: Point
         let icon: (size: Size, bitmap: [UInt32])
+        let sprite: Sprite
 
         func rect(margin: Int = 0) -> Rect {
             return Rect(
@@ -396,6 +836,7 @@ class PlayerControlView {
         init(center: Point, icon: (size: Size, bitmap: [UInt32])) {
             self.offset = Point(x: center.x - icon.size.width / 2, y: center.y - icon.size.height / 2)
             self.icon = icon
+            self.sprite = Sprite(icon)!
         }
     }
 
@@ -404,6 +845,8 @@ class PlayerControlView {
         case playPause
         case volume(diff: Int)
         case brightness(diff: Int)
+        case hud
+        case dumpTrace
     }
 
     private let closeButton = Icon(center: Point(x: 90, y: 150), icon: Icons.close)
@@ -415,46 +858,60 @@ class PlayerControlView {
     private let briMinusButton = Icon(center: Point(x: 355, y: 215), icon: Icons.minus)
     private let briPlusButton = Icon(center: Point(x: 655, y: 215), icon: Icons.plus)
     private let briIcon = Icon(center: Point(x: 433, y: 215), icon: Icons.light)
+    private let hudButton = Rect(x: 30, y: 230, width: 110, height: 60)
+    private let dumpButton = Rect(x: 160, y: 230, width: 110, height: 60)
 
     init(size: Size) {
-        let buffer = UnsafeMutableBufferPointer<UInt16>.allocate(capacity: size.width * size.height)
+        // Cache line aligned for the PPA, which blends the icons into it and it over the video
+        let buffer = Memory.allocate(type: UInt16.self, capacity: size.width * size.height, capability: [.spiram, .cacheAligned])!
         self.writer = PixelWriter(buffer: buffer, screenSize: size)
     }
 
-    func draw(pause: Bool, volume: Int, brightness: Int) -> UnsafeMutableBufferPointer<UInt16> {
-        writer.clear(color: .black)
-        writer.drawLine(from: .zero, to: Point(x: size.width - 1, y: 0), color: .white)
-
-        // Draw icons
-        writer.drawBitmap(closeButton.icon, at: closeButton.offset, color: .white)
-        if pause {
-            writer.drawBitmap(pauseButton.icon, at: pauseButton.offset, color: .white)
-        } else {
-            writer.drawBitmap(playButton.icon, at: playButton.offset, color: .white)
+    /// Whether the last CSV dump was written, shown by the colour of its button
+    var dumpResult: Bool? = nil
+
+    // What the buffer shows, only the parts that differ are drawn again
+    private var drawn: (pause: Bool, volume: Int, brightness: Int, hud: Bool)? = nil
+    private var drawnDumpResult: Bool? = nil
+
+    /// Draw what changed since the last call, returns the areas of the buffer that were drawn
+    @discardableResult
+    func draw(pause: Bool, volume: Int, brightness: Int, hud: Bool) -> [Rect] {
+        if drawn == nil {
+            writer.clear(color: .black)
+            writer.drawLine(from: .zero, to: Point(x: size.width - 1, y: 0), color: .white)
+            writer.drawSprite(closeButton.sprite, at: closeButton.offset, color: .white)
+            writer.drawSprite(volMinusButton.sprite, at: volMinusButton.offset, color: .white)
+            writer.drawSprite(volPlusButton.sprite, at: volPlusButton.offset, color: .white)
+            writer.drawSprite(volIcon.sprite, at: volIcon.offset, color: .white)
+            writer.drawSprite(briMinusButton.sprite, at: briMinusButton.offset, color: .white)
+            writer.drawSprite(briPlusButton.sprite, at: briPlusButton.offset, color: .white)
+            writer.drawSprite(briIcon.sprite, at: briIcon.offset, color: .white)
         }
-        writer.drawBitmap(volMinusButton.icon, at: volMinusButton.offset, color: .white)
-        writer.drawBitmap(volPlusButton.icon, at: volPlusButton.offset, color: .white)
-        writer.drawBitmap(volIcon.icon, at: volIcon.offset, color: .white)
-        writer.drawBitmap(briMinusButton.icon, at: briMinusButton.offset, color: .white)
-        writer.drawBitmap(briPlusButton.icon, at: briPlusButton.offset, color: .white)
-        writer.drawBitmap(briIcon.icon, at: briIcon.offset, color: .white)
 
-        let fontSize = 60
-        let volumeText = "\(volume)"
-        let volumeWidth = PixelWriter.defaultFont!.width(of: volumeText, fontSize: fontSize)
-        writer.drawText("\(volume)",
-            at: Point(x: 545 - volumeWidth / 2, y: 85 - fontSize / 2),
-            fontSize: fontSize,
-            color: .white
-        )
-        let brightnessText = "\(brightness)"
-        let brightnessWidth = PixelWriter.defaultFont!.width(of: brightnessText, fontSize: fontSize)
-        writer.drawText("\(brightness)",
-            at: Point(x: 545 - brightnessWidth / 2, y: 215 - fontSize / 2),
-            fontSize: fontSize,
-            color: .white
-        )
-        return buffer
+        if pause != drawn?.pause {
+            writer.fillRect(rect: playButton.rect().union(pauseButton.rect()), color: .black)
+            if pause {
+                writer.drawSprite(pauseButton.sprite, at: pauseButton.offset, color: .white)
+            } else {
+                writer.drawSprite(playButton.sprite, at: playButton.offset, color: .white)
+            }
+        }
+        if hud != drawn?.hud {
+            drawLabel("HUD", in: hudButton, color: hud ? .yellow : .white)
+        }
+        if drawn == nil || dumpResult != drawnDumpResult {
+            drawLabel("CSV", in: dumpButton, color: dumpResult.map { $0 ? Color.green : Color.red } ?? .white)
+            drawnDumpResult = dumpResult
+        }
+        if volume != drawn?.volume {
+            drawValue(volume, between: volIcon, and: volPlusButton)
+        }
+        if brightness != drawn?.brightness {
+            drawValue(brightness, between: briIcon, and: briPlusButton)
+        }
+        drawn = (pause, volume, brightness, hud)
+        return writer.damage.take()
     }
 
     func onTap(point: Point) -> Event? {
@@ -473,7 +930,33 @@ class PlayerControlView {
             return .brightness(diff: -10)
         } else if briPlusButton.rect(margin: margin).contains(point) {
             return .brightness(diff: 10)
+        } else if hudButton.contains(point) {
+            return .hud
+        } else if dumpButton.contains(point) {
+            return .dumpTrace
         }
         return nil
     }
+
+    private func drawValue(_ value: Int, between icon: Icon, and button: Icon) {
+        let fontSize = 60
+        let centerY = button.offset.y + button.icon.size.height / 2
+        let minX = icon.rect().maxX
+        writer.fillRect(rect: Rect(x: minX, y: centerY - fontSize * 2 / 3, width: button.offset.x - minX, height: fontSize * 4 / 3), color: .black)
+        let text = "\(value)"
+        let width = PixelWriter.defaultFont!.width(of: text, fontSize: fontSize)
+        writer.drawText(text,
+            at: Point(x: 545 - width / 2, y: centerY - fontSize / 2),
+            fontSize: fontSize,
+            color: .white
+        )
+    }
+
+    private func drawLabel(_ text: String, in rect: Rect, color: Color) {
+        let fontSize = 40
+        let width = PixelWriter.defaultFont!.width(of: text, fontSize: fontSize)
+        writer.fillRect(rect: rect, color: .black)
+        writer.drawRect(rect: rect, color: color)
+        writer.drawText(text, at: Point(x: rect.center.x - width / 2, y: rect.center.y - fontSize / 2), fontSize: fontSize, color: color)
+    }
 }
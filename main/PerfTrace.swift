@@ -0,0 +1,96 @@
+fileprivate let Log = Logger(tag: "PerfTrace")
+
+/// Timestamps of the playback pipeline, kept in a fixed ring per stage.
+/// Every ring has a single writer task and readers copy it without locking,
+/// a sample overwritten while it is copied only skews the statistics of that moment.
+class PerfTrace {
+    enum Stage: Int, CaseIterable {
+        case demux      // read of the compressed frame by the demuxer
+        case decode     // JPEG decode
+        case scale      // PPA scale, rotate and colour conversion
+        case present    // framebuffer switch request
+        case audio      // MP3 decode of one chunk
+
+        var name: String {
+            switch self {
+            case .demux: return "demux"
+            case .decode: return "decode"
+            case .scale: return "scale"
+            case .present: return "present"
+            case .audio: return "audio"
+            }
+        }
+    }
+
+    struct Sample {
+        var pts: Int64
+        var start: Int64
+        var duration: Int32
+    }
+
+    static let capacity = 256
+
+    private let samples: UnsafeMutableBufferPointer<Sample>
+    private let heads: UnsafeMutableBufferPointer<Int>
+
+    init?() {
+        let stages = Stage.allCases.count
+        guard let samples = Memory.allocate(type: Sample.self, capacity: stages * PerfTrace.capacity, capability: .spiram),
+            let heads = Memory.allocate(type: Int.self, capacity: stages) else {
+            return nil
+        }
+        self.samples = samples
+        self.heads = heads
+        heads.initialize(repeating: 0)
+    }
+
+    func record(_ stage: Stage, pts: Int64 = 0, start: Int64, end: Int64 = esp_timer_get_time()) {
+        let head = heads[stage.rawValue]
+        samples[stage.rawValue * PerfTrace.capacity + head % PerfTrace.capacity] =
+            Sample(pts: pts, start: start, duration: Int32(truncatingIfNeeded: end - start))
+        heads[stage.rawValue] = head + 1
+    }
+
+    /// Copy of the samples of a stage, oldest first
+    func samples(of stage: Stage) -> [Sample] {
+        let head = heads[stage.rawValue]
+        let count = min(head, PerfTrace.capacity)
+        var result: [Sample] = []
+        result.reserveCapacity(count)
+        for i in (head - count)..<head {
+            result.append(samples[stage.rawValue * PerfTrace.capacity + i % PerfTrace.capacity])
+        }
+        return result
+    }
+
+    /// Median and 99th percentile of the durations in the ring, in microseconds
+    func percentiles(of stage: Stage) -> (p50: Int32, p99: Int32)? {
+        let durations = samples(of: stage).map { $0.duration }.sorted()
+        if durations.isEmpty {
+            return nil
+        }
+        return (durations[durations.count / 2], durations[(durations.count * 99) / 100])
+    }
+
+    /// Write every ring as CSV: stage,pts_us,start_us,duration_us
+    func writeCSV(path: String) -> Bool {
+        guard let file = path.utf8CString.withUnsafeBufferPointer({ fopen($0.baseAddress, "w") }) else {
+            Log.error("Cannot open \(path)")
+            return false
+        }
+        fputs("stage,pts_us,start_us,duration_us\n", file)
+        for stage in Stage.allCases {
+            for sample in samples(of: stage) {
+                fputs("\(stage.name),\(sample.pts),\(sample.start),\(sample.duration)\n", file)
+            }
+        }
+        // The last buffered data reaches the disk in fclose, a full disk or a removed stick shows up there
+        let failed = ferror(file) != 0
+        if fclose(file) != 0 || failed {
+            Log.error("Failed to write \(path)")
+            return false
+        }
+        Log.info("Trace written to \(path)")
+        return true
+    }
+}
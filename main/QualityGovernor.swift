@@ -0,0 +1,124 @@
+fileprivate let Log = Logger(tag: "QualityGovernor")
+
+/// Steps the video quality down while the pipeline keeps falling behind and back up once it has headroom again.
+/// The decoder asks it which frames to decode, the presenter feeds it once per second.
+/// Every file starts at full quality, reset() is called when playback starts.
+class QualityGovernor {
+    enum Level: Int {
+        case full           // every frame, landscape video rotated to fill the screen
+        case halfRate       // every other frame is not decoded
+        case noRotation     // also letterbox landscape video instead of rotating it in the PPA
+
+        var description: String {
+            switch self {
+            case .full: return "full"
+            case .halfRate: return "half frame rate"
+            case .noRotation: return "half frame rate, no rotation"
+            }
+        }
+    }
+
+    // Seconds in a row before changing the level, stepping up needs a longer calm period
+    private let stepDownWindows = 2
+    private let stepUpWindows = 5
+
+    // The decoder and the scaler read the level while the presenter changes it
+    private let lock = Semaphore.createMutex()!
+    private var currentLevel: Level = .full
+    private var overloadedWindows = 0
+    private var calmWindows = 0
+    private var lastPts: Int64? = nil
+    private var skipNext = false
+    private var windowPeriod: Int64 = 0     // shortest pts step seen in the current window
+    private var framePeriod: Int64 = 33_333
+
+    var level: Level {
+        lock.take()
+        defer { lock.give() }
+        return currentLevel
+    }
+
+    var rotates: Bool {
+        return level.rawValue < Level.noRotation.rawValue
+    }
+
+    private var decodesEveryFrame: Bool {
+        return currentLevel == .full
+    }
+
+    /// Back to full quality with no history, a stall in the previous file does not carry over
+    func reset() {
+        lock.take()
+        defer { lock.give() }
+        currentLevel = .full
+        overloadedWindows = 0
+        calmWindows = 0
+        lastPts = nil
+        skipNext = false
+        windowPeriod = 0
+    }
+
+    /// Called by the decoder for every frame it receives, false when the frame should not be decoded
+    func shouldDecode(pts: Int64) -> Bool {
+        lock.take()
+        defer { lock.give() }
+        if let last = lastPts, pts > last {
+            let step = pts - last
+            windowPeriod = windowPeriod == 0 ? step : min(windowPeriod, step)
+        }
+        lastPts = pts
+        if decodesEveryFrame {
+            return true
+        }
+        skipNext.toggle()
+        return !skipNext
+    }
+
+    /// Called once per second with the frames shown, the frames lost to lateness or drops
+    /// and the average time of the slowest pipeline stage
+    func update(shown: Int, lost: Int, busiest: Int64) {
+        lock.take()
+        defer { lock.give() }
+        // Paused or between files, nothing to judge
+        guard shown + lost > 0 else {
+            return
+        }
+        if windowPeriod > 0 {
+            framePeriod = windowPeriod
+            windowPeriod = 0
+        }
+        // Every stage works on one frame at a time, the slowest one sets the frame rate
+        let period = decodesEveryFrame ? framePeriod : framePeriod * 2
+        let overloaded = lost * 10 > shown + lost || busiest > period
+        // The next level up must fit: at full rate the slowest stage gets half the time it has now
+        let budget = currentLevel == .halfRate ? framePeriod : period
+        let calm = lost == 0 && busiest * 10 < budget * 7
+
+        if overloaded {
+            overloadedWindows += 1
+            calmWindows = 0
+        } else if calm {
+            calmWindows += 1
+            overloadedWindows = 0
+        } else {
+            overloadedWindows = 0
+            calmWindows = 0
+        }
+
+        if overloadedWindows >= stepDownWindows, let lower = Level(rawValue: currentLevel.rawValue + 1) {
+            Log.warn("Falling behind (\(lost) of \(shown + lost) frames lost, slowest stage \(busiest / 1000)ms): \(currentLevel.description) -> \(lower.description)")
+            change(to: lower)
+        } else if calmWindows >= stepUpWindows, let higher = Level(rawValue: currentLevel.rawValue - 1) {
+            Log.info("Headroom (slowest stage \(busiest / 1000)ms): \(currentLevel.description) -> \(higher.description)")
+            change(to: higher)
+        }
+    }
+
+    // Called with lock held
+    private func change(to level: Level) {
+        currentLevel = level
+        overloadedWindows = 0
+        calmWindows = 0
+        skipNext = false
+    }
+}
@@ -48,6 +48,7 @@ static esp_lcd_panel_handle_t lcd_panel = NULL;
 static i2c_master_bus_handle_t i2c_bus = NULL;
 static i2c_master_dev_handle_t pi4io_1_handle = NULL;
 static SemaphoreHandle_t refresh_semaphore = NULL;
+static volatile uint32_t refresh_count = 0;
 static uint16_t *frame_buffer = NULL;
 static esp_lcd_touch_handle_t touch_handle = NULL;
 
@@ -69,15 +70,46 @@ static void draw_alarm_ui(void);
 static void draw_digit(int digit, int x, int y, int scale, uint16_t color);
 static void draw_button(int x, int y, int w, int h, uint16_t color, bool filled);
 
+// Fence of a present: the frame is on screen once refresh_count reaches target
+typedef struct {
+    uint32_t target;
+} present_fence_t;
+
 // Callback for DPI panel refresh done
 static bool on_refresh_done(esp_lcd_panel_handle_t panel, esp_lcd_dpi_panel_event_data_t *edata, void *user_ctx)
 {
     SemaphoreHandle_t sem = (SemaphoreHandle_t)user_ctx;
     BaseType_t xHigherPriorityTaskWoken = pdFALSE;
+    refresh_count++;
     xSemaphoreGiveFromISR(sem, &xHigherPriorityTaskWoken);
     return (xHigherPriorityTaskWoken == pdTRUE);
 }
 
+// Write back the frame buffer and return without waiting for the panel.
+// There is a single frame buffer: wait on the fence before drawing into it again.
+static present_fence_t display_present(void)
+{
+    esp_lcd_panel_draw_bitmap(lcd_panel, 0, 0, LCD_WIDTH, LCD_HEIGHT, frame_buffer);
+    // The refresh running now may have started before the write back, the next one shows the frame
+    present_fence_t fence = { .target = refresh_count + 2 };
+    return fence;
+}
+
+// Block until the frame of the fence has been scanned out
+static bool display_fence_wait(present_fence_t fence, TickType_t timeout)
+{
+    TickType_t start = xTaskGetTickCount();
+    while ((int32_t)(refresh_count - fence.target) < 0) {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= timeout) {
+            return false;
+        }
+        // Every refresh gives the semaphore, a waiter that misses one is woken by the next refresh
+        xSemaphoreTake(refresh_semaphore, timeout - elapsed);
+    }
+    return true;
+}
+
 // Initialize I2C and PI4IO expanders
 static esp_err_t init_i2c_pi4io(void)
 {
@@ -460,8 +492,7 @@ static void touch_task(void *arg)
                 }
                 
                 // Refresh display
-                xSemaphoreTake(refresh_semaphore, pdMS_TO_TICKS(100));
-                esp_lcd_panel_draw_bitmap(lcd_panel, 0, 0, LCD_WIDTH, LCD_HEIGHT, frame_buffer);
+                display_fence_wait(display_present(), pdMS_TO_TICKS(100));
                 
                 // Debounce
                 vTaskDelay(pdMS_TO_TICKS(200));
@@ -477,8 +508,7 @@ static void touch_task(void *arg)
                 }
             }
             touch_indicator--;
-            xSemaphoreTake(refresh_semaphore, pdMS_TO_TICKS(100));
-            esp_lcd_panel_draw_bitmap(lcd_panel, 0, 0, LCD_WIDTH, LCD_HEIGHT, frame_buffer);
+            display_fence_wait(display_present(), pdMS_TO_TICKS(100));
         }
         
         vTaskDelay(pdMS_TO_TICKS(50));
@@ -773,8 +803,7 @@ static void clock_task(void *arg)
             last_second = second;
             
             // Only refresh display when seconds change
-            xSemaphoreTake(refresh_semaphore, pdMS_TO_TICKS(100));
-            esp_lcd_panel_draw_bitmap(lcd_panel, 0, 0, LCD_WIDTH, LCD_HEIGHT, frame_buffer);
+            display_fence_wait(display_present(), pdMS_TO_TICKS(100));
         }
         
         // Update time
@@ -799,8 +828,7 @@ static void clock_task(void *arg)
                     for (int p = 0; p < LCD_WIDTH * LCD_HEIGHT; p++) {
                         frame_buffer[p] = (i % 2) ? 0xF800 : 0x001F; // Red/Blue flash
                     }
-                    xSemaphoreTake(refresh_semaphore, pdMS_TO_TICKS(100));
-                    esp_lcd_panel_draw_bitmap(lcd_panel, 0, 0, LCD_WIDTH, LCD_HEIGHT, frame_buffer);
+                    display_fence_wait(display_present(), pdMS_TO_TICKS(100));
                     vTaskDelay(pdMS_TO_TICKS(500));
                 }
                 alarm_triggered = false; // Reset after alarm
@@ -832,8 +860,7 @@ void app_main(void)
     
     // Clear screen initially
     memset(frame_buffer, 0, LCD_WIDTH * LCD_HEIGHT * 2);
-    xSemaphoreTake(refresh_semaphore, pdMS_TO_TICKS(100));
-    esp_lcd_panel_draw_bitmap(lcd_panel, 0, 0, LCD_WIDTH, LCD_HEIGHT, frame_buffer);
+    display_fence_wait(display_present(), pdMS_TO_TICKS(100));
     
     // Turn on backlight
     ESP_LOGI(TAG, "Turning on backlight...");
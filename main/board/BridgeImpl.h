@@ -8,8 +8,17 @@
 #include "usb/usb_host.h"
 #include "usb/msc_host_vfs.h"
 
-esp_err_t esp_lcd_dpi_panel_get_first_frame_buffer(esp_lcd_panel_handle_t panel, void **fb0) {
-    return esp_lcd_dpi_panel_get_frame_buffer(panel, 1, fb0);
+esp_err_t esp_lcd_dpi_panel_get_frame_buffers(esp_lcd_panel_handle_t panel, uint32_t fb_num, void **fbs) {
+    switch (fb_num) {
+    case 1:
+        return esp_lcd_dpi_panel_get_frame_buffer(panel, 1, &fbs[0]);
+    case 2:
+        return esp_lcd_dpi_panel_get_frame_buffer(panel, 2, &fbs[0], &fbs[1]);
+    case 3:
+        return esp_lcd_dpi_panel_get_frame_buffer(panel, 3, &fbs[0], &fbs[1], &fbs[2]);
+    default:
+        return ESP_ERR_INVALID_ARG;
+    }
 }
 
 /*
@@ -30,7 +30,8 @@ class M5StackTab5 {
             numDataLanes: 2,
             laneBitRateMbps: 730, // 720*1280 RGB24 60Hz
             width: 720,
-            height: 1280
+            height: 1280,
+            numFrameBuffers: 3
         )
         let touch = try Touch(
             i2c: i2c,
@@ -133,7 +134,57 @@ class M5StackTab5 {
         private let io: esp_lcd_panel_io_handle_t
         let panel: esp_lcd_panel_handle_t
         let size: Size
-        let semaphore = Semaphore.createBinary()!
+        /// Framebuffers of the DPI panel, the one scanned out is frontBuffer
+        private(set) var frameBuffers: [UnsafeMutableBufferPointer<UInt16>] = []
+        private var frontIndex = 0
+        private var backBuffers: Queue<Int>! = nil
+
+        // Taken while esp_lcd_panel_draw_bitmap may not be called, a copy holds it until on_color_trans_done
+        private let drawSlot = Semaphore.createBinary()!
+        // Taken from a framebuffer switch until the refresh that scans out the new buffer has started
+        private let switchSlot = Semaphore.createBinary()!
+        // Written by the tasks, read by the DPI interrupts
+        private var copyPending = false
+        private var switchPending = false
+        private var switchTarget = 0
+        private var switchPrevious = 0
+        private var presentSequence = 0
+        private var copySequence = 0
+        // Written by the DPI interrupts
+        private var refreshCount = 0
+        private var presentedCount = 0
+        private var copiedCount = 0
+
+        /// Signalled once a present or a copy has completed
+        struct Fence {
+            fileprivate enum Kind {
+                case present
+                case copy
+            }
+            fileprivate let display: Display
+            fileprivate let kind: Kind
+            fileprivate let sequence: Int
+
+            var isSignalled: Bool {
+                switch kind {
+                case .present: return display.presentedCount >= sequence
+                case .copy: return display.copiedCount >= sequence
+                }
+            }
+
+            /// Block until signalled, the slot is only given back once the operation behind it is done
+            @discardableResult
+            func wait(timeout: UInt32 = portMAX_DELAY) -> Bool {
+                if isSignalled {
+                    return true
+                }
+                let slot = kind == .present ? display.switchSlot : display.drawSlot
+                if slot.take(timeout: timeout) {
+                    slot.give()
+                }
+                return isSignalled
+            }
+        }
 
         init(
             backlightGpio: IDF.GPIO.Pin,
@@ -142,6 +193,7 @@ class M5StackTab5 {
             laneBitRateMbps: UInt32,
             width: UInt32,
             height: UInt32,
+            numFrameBuffers: UInt32 = 1,
         ) throws(IDF.Error) {
             // Setup Backlight
             ledcTimer = try IDF.LEDControl.makeTimer(dutyResolution: 12, freqHz: 5000)
@@ -186,7 +238,7 @@ class M5StackTab5 {
                 pixel_format: LCD_COLOR_PIXEL_FORMAT_RGB565,
                 in_color_format: lcd_color_format_t(rawValue: 0),
                 out_color_format: lcd_color_format_t(rawValue: 0),
-                num_fbs: 1,
+                num_fbs: numFrameBuffers,
                 video_timing: esp_lcd_video_timing_t(
                     h_size: width,
                     v_size: height,
@@ -234,11 +286,32 @@ class M5StackTab5 {
             var callbacks = esp_lcd_dpi_panel_event_callbacks_t()
             callbacks.on_refresh_done = { (panel, edata, user_ctx) in
                 let display = Unmanaged<Display>.fromOpaque(user_ctx!).takeUnretainedValue()
-                display.semaphore.giveFromISR()
-                return false
+                return display.onRefreshDone()
+            }
+            callbacks.on_color_trans_done = { (panel, edata, user_ctx) in
+                let display = Unmanaged<Display>.fromOpaque(user_ctx!).takeUnretainedValue()
+                return display.onColorTransDone()
             }
+            drawSlot.give()
+            switchSlot.give()
             esp_lcd_dpi_panel_register_event_callbacks(panel, &callbacks, Unmanaged.passUnretained(self).toOpaque())
-            semaphore.give()
+
+            var fbs: [UnsafeMutableRawPointer?] = [nil, nil, nil]
+            try IDF.Error.check(esp_lcd_dpi_panel_get_frame_buffers(panel, numFrameBuffers, &fbs))
+            guard let backBuffers = Queue<Int>(capacity: numFrameBuffers) else {
+                throw IDF.Error(ESP_ERR_NO_MEM)
+            }
+            let count = size.width * size.height
+            for i in 0..<Int(numFrameBuffers) {
+                frameBuffers.append(UnsafeMutableBufferPointer<UInt16>(
+                    start: fbs[i]!.bindMemory(to: UInt16.self, capacity: count),
+                    count: count
+                ))
+                if i != frontIndex {
+                    backBuffers.send(i)
+                }
+            }
+            self.backBuffers = backBuffers
         }
 
         var brightness: Int = 0 {
@@ -248,23 +321,114 @@ class M5StackTab5 {
         }
 
         var frameBuffer: UnsafeMutableBufferPointer<UInt16> {
-            get {
-                var fb: UnsafeMutableRawPointer?
-                esp_lcd_dpi_panel_get_first_frame_buffer(panel, &fb)
-                let typedPointer = fb!.bindMemory(to: UInt16.self, capacity: size.width * size.height)
-                return UnsafeMutableBufferPointer<UInt16>(start: typedPointer, count: size.width * size.height)
+            return frameBuffers[0]
+        }
+
+        var frontBuffer: UnsafeMutableBufferPointer<UInt16> {
+            return frameBuffers[frontIndex]
+        }
+
+        /// A framebuffer that is not scanned out, render a full frame into it and pass it to present(_:)
+        func acquireBackBuffer(timeout: UInt32 = portMAX_DELAY) -> UnsafeMutableBufferPointer<UInt16>? {
+            guard let index = backBuffers.receive(timeout: timeout) else {
+                return nil
             }
+            return frameBuffers[index]
         }
 
-        func drawBitmap(rect: Rect, data: UnsafeRawPointer, retry: Bool = true) {
-            semaphore.take(timeout: 100)
-            for _ in 0..<5 {
-                let result = esp_lcd_panel_draw_bitmap(panel, Int32(rect.minX), Int32(rect.minY), Int32(rect.maxX), Int32(rect.maxY), data)
-                if result == ESP_OK || !retry {
-                    break
+        /// Give back a back buffer without presenting it
+        func releaseBackBuffer(_ buffer: UnsafeMutableBufferPointer<UInt16>) {
+            if let index = frameBuffers.firstIndex(where: { $0.baseAddress == buffer.baseAddress }) {
+                backBuffers.send(index)
+            }
+        }
+
+        /// Scan out a back buffer instead of copying it. The panel switches when the current refresh ends,
+        /// the previous front buffer becomes a back buffer after that and the fence is signalled.
+        /// Waits only while the switch of the previous present is still pending.
+        @discardableResult
+        func present(_ buffer: UnsafeMutableBufferPointer<UInt16>) -> Fence {
+            guard let index = frameBuffers.firstIndex(where: { $0.baseAddress == buffer.baseAddress }) else {
+                return Fence(display: self, kind: .present, sequence: 0)
+            }
+            switchSlot.take()
+            drawSlot.take()
+            esp_lcd_panel_draw_bitmap(panel, 0, 0, Int32(size.width), Int32(size.height), buffer.baseAddress)
+            drawSlot.give()
+            presentSequence += 1
+            switchPrevious = frontIndex
+            frontIndex = index
+            // A refresh that ends before this point may not have switched yet, wait for the one after it
+            switchTarget = refreshCount + 1
+            switchPending = true
+            return Fence(display: self, kind: .present, sequence: presentSequence)
+        }
+
+        /// Copy a bitmap into the framebuffer on screen. `data` must stay valid until the fence is signalled.
+        @discardableResult
+        func drawBitmap(rect: Rect, data: UnsafeRawPointer) -> Fence {
+            drawSlot.take()
+            copyPending = true
+            let result = esp_lcd_panel_draw_bitmap(panel, Int32(rect.minX), Int32(rect.minY), Int32(rect.maxX), Int32(rect.maxY), data)
+            if result != ESP_OK {
+                Log.error("Failed to draw bitmap: \(IDF.Error(result))")
+                copyPending = false
+                drawSlot.give()
+                return Fence(display: self, kind: .copy, sequence: 0)
+            }
+            copySequence += 1
+            return Fence(display: self, kind: .copy, sequence: copySequence)
+        }
+
+        /// Copy the damaged areas of a screen sized buffer. Rows of the buffer are contiguous, so every area is
+        /// widened to whole rows and overlapping bands are copied once. The fence covers all of them.
+        @discardableResult
+        func drawBitmap(damage: [Rect], from buffer: UnsafeMutableBufferPointer<UInt16>) -> Fence {
+            var fence = Fence(display: self, kind: .copy, sequence: 0)
+            var bands = damage.filter { !$0.isEmpty }.map { (minY: max(0, $0.minY), maxY: min(size.height, $0.maxY)) }
+            bands.sort { $0.minY < $1.minY }
+            var i = 0
+            while i < bands.count {
+                var band = bands[i]
+                i += 1
+                while i < bands.count && bands[i].minY <= band.maxY {
+                    band.maxY = max(band.maxY, bands[i].maxY)
+                    i += 1
+                }
+                if band.maxY > band.minY {
+                    // Copies are queued one after another, the last fence is signalled after the others
+                    fence = drawBitmap(
+                        rect: Rect(x: 0, y: band.minY, width: size.width, height: band.maxY - band.minY),
+                        data: buffer.baseAddress! + band.minY * size.width
+                    )
                 }
-                Task.delay(10)
             }
+            return fence
+        }
+
+        private func onRefreshDone() -> Bool {
+            refreshCount += 1
+            var woken = false
+            if switchPending && refreshCount >= switchTarget {
+                switchPending = false
+                if switchPrevious != frontIndex {
+                    backBuffers.sendFromISR(switchPrevious, woken: &woken)
+                }
+                presentedCount += 1
+                switchSlot.giveFromISR(woken: &woken)
+            }
+            return woken
+        }
+
+        private func onColorTransDone() -> Bool {
+            var woken = false
+            // Also called for a framebuffer switch, which does not hold the slot
+            if copyPending {
+                copyPending = false
+                copiedCount += 1
+                drawSlot.giveFromISR(woken: &woken)
+            }
+            return woken
         }
     }
 
@@ -370,6 +534,8 @@ class M5StackTab5 {
     class Audio {
         let i2s: IDF.I2S
         let outputDevice: esp_codec_dev_handle_t
+        let txProgress: UnsafeMutablePointer<i2s_tx_progress_t>
+        private var bytesPerFrame: UInt32 = 4
 
         init(
             num: UInt32? = nil,
@@ -417,6 +583,8 @@ class M5StackTab5 {
                 )
             )
             outputDevice = Audio.initSpeaker(i2s: i2s, i2c: i2c)
+            txProgress = i2s_tx_progress_new(i2s.channels.tx)
+                .unwrap(errMsg: { "Failed to register I2S TX callback" })
             volume = 0
             try reconfigOutput(rate: 48000, bps: 16, ch: 2)
         }
@@ -461,11 +629,21 @@ class M5StackTab5 {
             fs.bits_per_sample = bps
             try IDF.Error.check(esp_codec_dev_close(outputDevice))
             try IDF.Error.check(esp_codec_dev_open(outputDevice, &fs))
+            // Reopening the device drops whatever the DMA still held
+            i2s_tx_progress_reset(txProgress)
+            bytesPerFrame = max(1, UInt32(bps) / 8 * UInt32(ch))
         }
         func write(_ data: UnsafeMutableRawBufferPointer) throws(IDF.Error) {
+            // Count the data before writing, the DMA may send part of it before the write returns
+            i2s_tx_progress_add(txProgress, UInt32(data.count))
             try IDF.Error.check(esp_codec_dev_write(outputDevice, data.baseAddress!, Int32(data.count)))
         }
 
+        /// Samples per channel written but not played yet
+        var queuedFrames: UInt32 {
+            return i2s_tx_progress_queued(txProgress) / bytesPerFrame
+        }
+
         var volume: Int = -1 {
             didSet {
                 volume = max(0, min(100, volume))
@@ -2,3 +2,5 @@
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "thirdparty/stb_truetype.h"
+
+#include "pixel_kernels.h"
@@ -63,19 +63,17 @@ class Font {
         return sizeInfoCache!
     }
     func width(of codePoint: Unicode.Scalar, fontSize: Int? = nil) -> Int {
+        lock.take()
+        defer { lock.give() }
         if let fontSize = fontSize {
             self.fontSize = fontSize
         }
-        if let charWidth = sizeInfo.charWidth {
-            return charWidth
-        } else {
-            var charWidth: Int32 = 0
-            stbtt_GetCodepointHMetrics(&fontInfo, Int32(codePoint.value), &charWidth, nil)
-            return Int(Float(charWidth) * sizeInfo.scale)
-        }
+        return advance(of: codePoint)
     }
 
     func width(of text: String, fontSize: Int? = nil) -> Int {
+        lock.take()
+        defer { lock.give() }
         if let fontSize = fontSize {
             self.fontSize = fontSize
         }
@@ -84,33 +82,101 @@ class Font {
         } else {
             var width = 0
             for char in text.unicodeScalars {
-                width += self.width(of: char)
+                width += advance(of: char)
             }
             return width
         }
     }
 
-    func drawBitmap(_ string: String, maxWidth: Int? = nil, drawPixel: (Point, UInt8) -> Void) {
+    // Called with lock held
+    private func advance(of codePoint: Unicode.Scalar) -> Int {
+        if let charWidth = sizeInfo.charWidth {
+            return charWidth
+        } else {
+            var charWidth: Int32 = 0
+            stbtt_GetCodepointHMetrics(&fontInfo, Int32(codePoint.value), &charWidth, nil)
+            return Int(Float(charWidth) * sizeInfo.scale)
+        }
+    }
+
+    /// Coverage bitmap of a character, owned by the glyph cache or mapped from the atlas
+    struct Glyph {
+        let bitmap: UnsafePointer<UInt8>
+        let size: Size
+        let offset: Point       // of the top left from the pen position on the baseline
+        fileprivate var lastUse: UInt32 = 0
+    }
+
+    /// Prebaked glyphs served before the cache, nil rasterises everything at runtime
+    var atlas: FontAtlas? = nil
+
+    // Glyphs of every size drawn so far, the least recently used ones are freed beyond the budget
+    static let glyphCacheBudget = 512 * 1024
+    private var glyphs: [UInt64: Glyph] = [:]
+    private var glyphBytes = 0
+    private var useCount: UInt32 = 0
+    // The cache and fontSize are shared by every task that draws text
+    private let lock = Semaphore.createMutex()!
+
+    /// checksumAdjustment of the 'head' table, identifies the font an atlas was made from
+    var checksum: UInt32 {
+        return UInt32(bigEndian: fontData.loadUnaligned(fromByteOffset: Int(fontInfo.head) + 8, as: UInt32.self))
+    }
+
+    /// Calls draw with the position of each glyph relative to the top left of the text
+    func drawBitmap(_ string: String, fontSize: Int? = nil, maxWidth: Int? = nil, draw: (Point, Glyph) -> Void) {
+        lock.take()
+        defer { lock.give() }
+        if let fontSize = fontSize {
+            self.fontSize = fontSize
+        }
         var offsetX: Int = 0
         for char in string.unicodeScalars {
-            var bitmapWidth: Int32 = 0, bitmapHeight: Int32 = 0
-            var xoff: Int32 = 0, yoff: Int32 = 0
-            if let bitmap = stbtt_GetCodepointBitmap(
-                &fontInfo, 0, sizeInfo.scale, Int32(char.value),
-                &bitmapWidth, &bitmapHeight, &xoff, &yoff
-            ) {
-                if let maxWidth = maxWidth, offsetX + Int(bitmapWidth) > maxWidth {
+            if let glyph = glyph(of: char) {
+                if let maxWidth = maxWidth, offsetX + glyph.size.width > maxWidth {
                     break
                 }
-                for y in 0..<bitmapHeight {
-                    for x in 0..<bitmapWidth {
-                        let point = Point(x: Int(x + xoff) + offsetX, y: sizeInfo.baseline + Int(yoff + y))
-                        let pixel = bitmap[Int(y * bitmapWidth + x)]
-                        drawPixel(point, pixel)
-                    }
-                }
+                draw(Point(x: glyph.offset.x + offsetX, y: sizeInfo.baseline + glyph.offset.y), glyph)
             }
-            offsetX += self.width(of: char)
+            offsetX += advance(of: char)
+        }
+    }
+
+    private func glyph(of codePoint: Unicode.Scalar) -> Glyph? {
+        if let baked = atlas?.glyph(of: codePoint, fontSize: fontSize) {
+            return Glyph(bitmap: baked.bitmap, size: baked.size, offset: baked.offset)
+        }
+        let key = UInt64(codePoint.value) << 16 | UInt64(fontSize)
+        useCount &+= 1
+        if glyphs[key] != nil {
+            glyphs[key]!.lastUse = useCount
+            return glyphs[key]
+        }
+
+        var x0: Int32 = 0, y0: Int32 = 0, x1: Int32 = 0, y1: Int32 = 0
+        stbtt_GetCodepointBitmapBox(&fontInfo, Int32(codePoint.value), sizeInfo.scale, sizeInfo.scale, &x0, &y0, &x1, &y1)
+        guard x1 > x0 && y1 > y0 else {
+            // Blank, like a space
+            return nil
+        }
+        let size = Size(width: Int(x1 - x0), height: Int(y1 - y0))
+        let bytes = size.width * size.height
+        while glyphBytes + bytes > Font.glyphCacheBudget, let oldest = glyphs.min(by: { $0.value.lastUse < $1.value.lastUse }) {
+            free(UnsafeMutablePointer(mutating: oldest.value.bitmap))
+            glyphBytes -= oldest.value.size.width * oldest.value.size.height
+            glyphs[oldest.key] = nil
+        }
+        guard let bitmap = Memory.allocate(type: UInt8.self, capacity: bytes, capability: .spiram) else {
+            Log.error("Cannot allocate a \(size.width)x\(size.height) glyph")
+            return nil
         }
+        stbtt_MakeCodepointBitmap(
+            &fontInfo, bitmap.baseAddress, Int32(size.width), Int32(size.height), Int32(size.width),
+            sizeInfo.scale, sizeInfo.scale, Int32(codePoint.value)
+        )
+        let glyph = Glyph(bitmap: bitmap.baseAddress!, size: size, offset: Point(x: Int(x0), y: Int(y0)), lastUse: useCount)
+        glyphs[key] = glyph
+        glyphBytes += bytes
+        return glyph
     }
 }
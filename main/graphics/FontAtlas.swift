@@ -0,0 +1,73 @@
+fileprivate let Log = Logger(tag: "FontAtlas")
+
+/// Glyphs prebaked by resources/font_atlas.c, the coverage bitmaps are read from the mapped partition
+struct FontAtlas {
+    private static let magic: UInt32 = 0x4C54_4146    // 'FATL'
+    private static let version: UInt16 = 1
+    private static let headerSize = 16
+    private static let entrySize = 16
+
+    // Unmaps the data when released
+    private let partition: IDF.Partition
+    private let data: UnsafeRawBufferPointer
+    private let count: Int
+
+    /// Nil when the partition holds no atlas or one made from another font
+    init?(from partition: IDF.Partition, fontChecksum: UInt32) {
+        guard let data = partition.mmap else {
+            Log.error("Failed to map font atlas partition")
+            return nil
+        }
+        let magic = data.loadUnaligned(fromByteOffset: 0, as: UInt32.self)
+        let version = data.loadUnaligned(fromByteOffset: 4, as: UInt16.self)
+        let count = Int(data.loadUnaligned(fromByteOffset: 8, as: UInt32.self))
+        let checksum = data.loadUnaligned(fromByteOffset: 12, as: UInt32.self)
+        guard magic == FontAtlas.magic, version == FontAtlas.version,
+            FontAtlas.headerSize + count * FontAtlas.entrySize <= data.count else {
+            Log.warn("No font atlas, glyphs are rasterised at runtime")
+            return nil
+        }
+        guard checksum == fontChecksum else {
+            Log.warn("Font atlas was made from another font, glyphs are rasterised at runtime")
+            return nil
+        }
+        self.partition = partition
+        self.data = data
+        self.count = count
+        Log.info("\(count) prebaked glyphs")
+    }
+
+    /// Bitmap, size and offset from the pen position on the baseline, as stbtt_GetCodepointBitmap would return them
+    func glyph(of codePoint: Unicode.Scalar, fontSize: Int) -> (bitmap: UnsafePointer<UInt8>, size: Size, offset: Point)? {
+        guard fontSize < 256 else {
+            return nil
+        }
+        let key = codePoint.value << 8 | UInt32(fontSize)
+        var low = 0, high = count
+        while low < high {
+            let mid = (low + high) / 2
+            let entry = FontAtlas.headerSize + mid * FontAtlas.entrySize
+            let midKey = data.loadUnaligned(fromByteOffset: entry, as: UInt32.self)
+            if midKey < key {
+                low = mid + 1
+            } else if midKey > key {
+                high = mid
+            } else {
+                let offset = Int(data.loadUnaligned(fromByteOffset: entry + 4, as: UInt32.self))
+                let size = Size(
+                    width: Int(data.loadUnaligned(fromByteOffset: entry + 8, as: UInt16.self)),
+                    height: Int(data.loadUnaligned(fromByteOffset: entry + 10, as: UInt16.self))
+                )
+                guard offset + size.width * size.height <= data.count else {
+                    return nil
+                }
+                let origin = Point(
+                    x: Int(data.loadUnaligned(fromByteOffset: entry + 12, as: Int16.self)),
+                    y: Int(data.loadUnaligned(fromByteOffset: entry + 14, as: Int16.self))
+                )
+                return ((data.baseAddress! + offset).assumingMemoryBound(to: UInt8.self), size, origin)
+            }
+        }
+        return nil
+    }
+}
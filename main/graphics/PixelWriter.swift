@@ -1,25 +1,63 @@
 fileprivate let Log = Logger(tag: "PixelWriter")
 
+/// Areas of a buffer drawn since they were last taken, overlapping ones are merged
+final class Damage {
+    private var rects: [Rect] = []
+
+    func add(_ rect: Rect) {
+        guard !rect.isEmpty else {
+            return
+        }
+        var merged = rect
+        var i = 0
+        while i < rects.count {
+            if rects[i].intersects(merged) {
+                merged = merged.union(rects.remove(at: i))
+                // The grown rect may reach one that was checked already
+                i = 0
+            } else {
+                i += 1
+            }
+        }
+        rects.append(merged)
+    }
+
+    func take() -> [Rect] {
+        defer { rects.removeAll() }
+        return rects
+    }
+}
+
 struct PixelWriter {
 
     static var defaultFont: Font?
+    /// Blends sprites when set, the CPU does it otherwise
+    static var blender: IDF.PPAClient?
 
     let buffer: UnsafeMutableBufferPointer<UInt16>
     let screenSize: Size
     var rect: Rect?
     var font: Font? = nil
+    /// Everything drawn is recorded here, flush `damage.take()` instead of the whole buffer
+    let damage = Damage()
 
     private var offset: Point { rect?.origin ?? .zero }
     private func getRect() -> Rect { rect ?? Rect(origin: .zero, size: screenSize) }
 
+    private func addDamage(_ rect: Rect) {
+        damage.add(rect.intersection(Rect(origin: .zero, size: screenSize)))
+    }
+
     func clear(color: Color = .black) {
-        buffer.initialize(repeating: color.rgb565)
+        pixel_fill(buffer.baseAddress, color.rgb565, buffer.count)
+        addDamage(Rect(origin: .zero, size: screenSize))
     }
 
     func drawPixel(at point: Point, color: Color) {
         let point = point + offset
         if getRect().contains(point) {
             buffer[Int(point.y * screenSize.width) + Int(point.x)] = color.rgb565
+            addDamage(Rect(origin: point, size: Size(width: 1, height: 1)))
         }
     }
 
@@ -33,12 +71,14 @@ struct PixelWriter {
             for y in startY...endY {
                 buffer[Int(y * screenSize.width) + Int(from.x)] = color
             }
+            addDamage(Rect(x: from.x, y: startY, width: 1, height: endY - startY + 1))
         } else if from.y == to.y {
             let startX = min(from.x, to.x, 0)
             let endX = max(from.x, to.x, screenSize.width - 1)
             for x in startX...endX {
                 buffer[Int(from.y) * screenSize.width + Int(x)] = color
             }
+            addDamage(Rect(x: startX, y: from.y, width: endX - startX + 1, height: 1))
         } else {
             Log.error("Only horizontal or vertical lines are supported.")
         }
@@ -52,14 +92,16 @@ struct PixelWriter {
         let endY = min(screenSize.height, rect.maxY)
         let color = color.rgb565
 
-        for x in startX..<endX {
-            buffer[Int(startY) * Int(screenSize.width) + x] = color
-            buffer[Int(endY - 1) * Int(screenSize.width) + x] = color
-        }
-        for y in startY..<endY {
-            buffer[y * Int(screenSize.width) + startX] = color
-            buffer[y * Int(screenSize.width) + endX - 1] = color
+        guard startX < endX && startY < endY else {
+            return
         }
+        let base = buffer.baseAddress!
+        let width = endX - startX, height = endY - startY
+        pixel_fill(base + startY * screenSize.width + startX, color, width)
+        pixel_fill(base + (endY - 1) * screenSize.width + startX, color, width)
+        pixel_fill_rect(base + startY * screenSize.width + startX, screenSize.width, 1, height, color)
+        pixel_fill_rect(base + startY * screenSize.width + endX - 1, screenSize.width, 1, height, color)
+        addDamage(rect)
     }
 
     func fillRect(rect: Rect, color: Color) {
@@ -70,11 +112,11 @@ struct PixelWriter {
         let endY = min(screenSize.height, rect.maxY)
         let color = color.rgb565
 
-        for y in startY..<endY {
-            for x in startX..<endX {
-                buffer[y * Int(screenSize.width) + x] = color
-            }
+        guard startX < endX && startY < endY else {
+            return
         }
+        pixel_fill_rect(buffer.baseAddress! + startY * screenSize.width + startX, screenSize.width, endX - startX, endY - startY, color)
+        addDamage(rect)
     }
 
     func drawText(_ text: String, at point: Point, fontSize: Int, color: Color) {
@@ -83,27 +125,61 @@ struct PixelWriter {
         }
         let color = color.rgb565
         let point = point + offset
-        font.fontSize = fontSize
-        font.drawBitmap(text, maxWidth: screenSize.width - point.x) { (pixelPoint, value) in
-            let point = pixelPoint + point
-            if value > 0 {
-                buffer[point.y * screenSize.width + point.x] = color
+        font.drawBitmap(text, fontSize: fontSize, maxWidth: screenSize.width - point.x) { (glyphPoint, glyph) in
+            let origin = glyphPoint + point
+            // Clipped to the buffer, the glyph box may reach above the text or below it
+            let startX = max(0, -origin.x), endX = min(glyph.size.width, screenSize.width - origin.x)
+            let startY = max(0, -origin.y), endY = min(glyph.size.height, screenSize.height - origin.y)
+            guard startX < endX && startY < endY else {
+                return
             }
+            addDamage(Rect(origin: origin, size: glyph.size))
+            // Antialiased: the coverage blends the colour over what is drawn below
+            pixel_blend_a8(
+                buffer.baseAddress! + (origin.y + startY) * screenSize.width + origin.x + startX, screenSize.width,
+                glyph.bitmap + startY * glyph.size.width + startX, glyph.size.width,
+                endX - startX, endY - startY, color
+            )
         }
     }
 
     func drawBitmap(_ data: (size: Size, bitmap: [UInt32]), at point: Point, color: Color) {
-        let rowCount = (data.size.width + 31) / 32
-        var row = 0
-        for y in 0..<data.size.height {
-            for x in 0..<data.size.width {
-                let pixelIndex = row + x / 32
-                let bitIndex = x % 32
-                if (data.bitmap[pixelIndex] & (1 << (31 - bitIndex))) != 0 {
-                    buffer[Int((point.y + y) * screenSize.width) + Int(point.x + x)] = color.rgb565
-                }
+        guard Rect(origin: .zero, size: screenSize).intersection(Rect(origin: point, size: data.size)).size == data.size else {
+            Log.error("Bitmap at \(point) does not fit in the buffer.")
+            return
+        }
+        data.bitmap.withUnsafeBufferPointer { bits in
+            pixel_expand_1bpp(
+                buffer.baseAddress! + point.y * screenSize.width + point.x, screenSize.width,
+                bits.baseAddress, data.size.width, data.size.height, color.rgb565
+            )
+        }
+        addDamage(Rect(origin: point, size: data.size))
+    }
+
+    /// Draw the sprite in one colour. The PPA needs the buffer aligned to the cache line, the CPU blends when it fails.
+    func drawSprite(_ sprite: Sprite, at point: Point, color: Color) {
+        let point = point + offset
+        let rect = Rect(origin: point, size: sprite.size)
+        guard rect.intersection(Rect(origin: .zero, size: screenSize)) == rect else {
+            Log.error("Sprite at \(point) does not fit in the buffer.")
+            return
+        }
+        addDamage(rect)
+        if let blender = PixelWriter.blender {
+            do throws(IDF.Error) {
+                try blender.blend(
+                    mask: UnsafeRawPointer(sprite.alpha.baseAddress!), maskSize: sprite.size, color: color.rgb565,
+                    into: buffer, size: screenSize, at: point
+                )
+                return
+            } catch {
+                Log.error("PPA blend failed: \(error)")
             }
-            row += rowCount
         }
+        pixel_blend_a8(
+            buffer.baseAddress! + point.y * screenSize.width + point.x, screenSize.width,
+            sprite.alpha.baseAddress, sprite.size.width, sprite.size.width, sprite.size.height, color.rgb565
+        )
     }
 }
@@ -0,0 +1,26 @@
+fileprivate let Log = Logger(tag: "Sprite")
+
+/// 1bpp icon expanded once into an 8-bit alpha mask in DMA capable memory.
+/// The PPA blends it in any colour, A8 with a fixed colour is the blend format that fits one colour icons.
+struct Sprite {
+    let size: Size
+    let alpha: UnsafeMutableBufferPointer<UInt8>
+
+    init?(_ icon: (size: Size, bitmap: [UInt32])) {
+        guard let alpha = Memory.allocate(
+            type: UInt8.self, capacity: icon.size.width * icon.size.height, capability: [.spiram, .dma, .cacheAligned]
+        ) else {
+            Log.error("Cannot allocate a \(icon.size.width)x\(icon.size.height) sprite")
+            return nil
+        }
+        let words = (icon.size.width + 31) / 32
+        for y in 0..<icon.size.height {
+            for x in 0..<icon.size.width {
+                let set = icon.bitmap[y * words + x / 32] & (1 << (31 - x % 32)) != 0
+                alpha[y * icon.size.width + x] = set ? 0xFF : 0
+            }
+        }
+        self.size = icon.size
+        self.alpha = alpha
+    }
+}
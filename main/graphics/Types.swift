@@ -97,6 +97,27 @@ struct Rect: Equatable, CustomStringConvertible {
         return point.x >= minX && point.x < maxX && point.y >= minY && point.y < maxY
     }
 
+    /// Smallest rect that covers both, an empty rect covers nothing
+    func union(_ other: Rect) -> Rect {
+        if isEmpty { return other }
+        if other.isEmpty { return self }
+        let minX = min(self.minX, other.minX), minY = min(self.minY, other.minY)
+        return Rect(x: minX, y: minY, width: max(maxX, other.maxX) - minX, height: max(maxY, other.maxY) - minY)
+    }
+
+    func intersection(_ other: Rect) -> Rect {
+        let minX = max(self.minX, other.minX), minY = max(self.minY, other.minY)
+        let maxX = min(self.maxX, other.maxX), maxY = min(self.maxY, other.maxY)
+        if maxX <= minX || maxY <= minY {
+            return .zero
+        }
+        return Rect(x: minX, y: minY, width: maxX - minX, height: maxY - minY)
+    }
+
+    func intersects(_ other: Rect) -> Bool {
+        return !intersection(other).isEmpty
+    }
+
     static func == (lhs: Self, rhs: Self) -> Bool {
         return lhs.origin == rhs.origin && lhs.size == rhs.size
     }
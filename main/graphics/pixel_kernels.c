@@ -0,0 +1,167 @@
+#include "pixel_kernels.h"
+
+#include <string.h>
+
+#ifdef ESP_PLATFORM
+#include "soc/soc_caps.h"
+#endif
+
+#if defined(SOC_CPU_HAS_PIE) && SOC_CPU_HAS_PIE
+#define PIXEL_USE_PIE 1
+#else
+#define PIXEL_USE_PIE 0
+#endif
+
+/* Pixels with the green field moved to the upper half, the fields get room to be multiplied by 0..32 */
+#define SPREAD_MASK 0x07E0F81Fu
+
+static inline uint32_t spread(uint16_t pixel)
+{
+    return (pixel | ((uint32_t)pixel << 16)) & SPREAD_MASK;
+}
+
+static inline uint16_t pack(uint32_t spread)
+{
+    return (uint16_t)(spread | (spread >> 16));
+}
+
+#if PIXEL_USE_PIE
+/* vst.128 ignores the low 4 bits of the address, the caller aligns dst */
+static void fill_vectors(uint16_t *dst, uint16_t color, size_t vectors)
+{
+    const uint16_t value = color;
+    const uint16_t *src = &value;
+    asm volatile(
+        "esp.vldbc.16.ip q0, %[src], 0\n"
+        "1:\n"
+        "esp.vst.128.ip q0, %[dst], 16\n"
+        "addi %[n], %[n], -1\n"
+        "bnez %[n], 1b\n"
+        : [dst] "+r"(dst), [src] "+r"(src), [n] "+r"(vectors)
+        :
+        : "memory"
+    );
+}
+#endif
+
+void pixel_fill(uint16_t *dst, uint16_t color, size_t count)
+{
+#if PIXEL_USE_PIE
+    while (count > 0 && ((uintptr_t)dst & 15) != 0) {
+        *dst++ = color;
+        count--;
+    }
+    if (count >= 8) {
+        fill_vectors(dst, color, count / 8);
+        dst += count & ~(size_t)7;
+        count &= 7;
+    }
+    while (count-- > 0) {
+        *dst++ = color;
+    }
+#else
+    /* Two pixels per store once dst is word aligned */
+    if (count > 0 && ((uintptr_t)dst & 2) != 0) {
+        *dst++ = color;
+        count--;
+    }
+    uint32_t pair = color | ((uint32_t)color << 16);
+    uint32_t *words = (uint32_t *)dst;
+    for (size_t i = 0; i < count / 2; i++) {
+        words[i] = pair;
+    }
+    if (count & 1) {
+        dst[count - 1] = color;
+    }
+#endif
+}
+
+void pixel_fill_rect(uint16_t *dst, size_t stride, size_t width, size_t height, uint16_t color)
+{
+    if (width == stride) {
+        pixel_fill(dst, color, width * height);
+        return;
+    }
+    for (size_t y = 0; y < height; y++) {
+        pixel_fill(dst + y * stride, color, width);
+    }
+}
+
+void pixel_expand_1bpp(uint16_t *dst, size_t stride, const uint32_t *bits, size_t width, size_t height, uint16_t color)
+{
+    size_t words = (width + 31) / 32;
+    for (size_t y = 0; y < height; y++) {
+        uint16_t *row = dst + y * stride;
+        for (size_t w = 0; w < words; w++) {
+            uint32_t word = bits[w];
+            size_t x = w * 32;
+            /* Icons are runs of set bits, fill each run instead of testing every bit */
+            while (word != 0) {
+                size_t start = __builtin_clz(word);
+                uint32_t shifted = word << start;
+                size_t length = shifted == 0xFFFFFFFFu ? 32 - start : (size_t)__builtin_clz(~shifted);
+                if (x + start >= width) {
+                    break;
+                }
+                size_t end = x + start + length < width ? x + start + length : width;
+                for (size_t i = x + start; i < end; i++) {
+                    row[i] = color;
+                }
+                word = start + length >= 32 ? 0 : word & (0xFFFFFFFFu >> (start + length));
+            }
+        }
+        bits += words;
+    }
+}
+
+static inline uint16_t blend(uint16_t bg, uint32_t fg, uint32_t a)
+{
+    /* 5-bit alpha, the fields are 5 bits apart so the products do not overlap */
+    a = (a + 4) >> 3;
+    uint32_t spread_bg = spread(bg);
+    return pack((spread_bg + (((fg - spread_bg) * a) >> 5)) & SPREAD_MASK);
+}
+
+void pixel_blend_a8(uint16_t *dst, size_t stride, const uint8_t *coverage, size_t coverage_stride,
+                    size_t width, size_t height, uint16_t color)
+{
+    uint32_t fg = spread(color);
+    for (size_t y = 0; y < height; y++) {
+        uint16_t *row = dst + y * stride;
+        const uint8_t *alpha = coverage + y * coverage_stride;
+        size_t x = 0;
+        /* Glyphs are mostly empty or solid: skip and fill four pixels at a time, blend only the edges */
+        while (x + 4 <= width) {
+            uint32_t quad;
+            memcpy(&quad, alpha + x, sizeof(quad));
+            if (quad == 0) {
+                x += 4;
+                continue;
+            }
+            if (quad == 0xFFFFFFFFu) {
+                row[x] = color;
+                row[x + 1] = color;
+                row[x + 2] = color;
+                row[x + 3] = color;
+                x += 4;
+                continue;
+            }
+            for (size_t end = x + 4; x < end; x++) {
+                uint32_t a = alpha[x];
+                if (a == 255) {
+                    row[x] = color;
+                } else if (a != 0) {
+                    row[x] = blend(row[x], fg, a);
+                }
+            }
+        }
+        for (; x < width; x++) {
+            uint32_t a = alpha[x];
+            if (a == 255) {
+                row[x] = color;
+            } else if (a != 0) {
+                row[x] = blend(row[x], fg, a);
+            }
+        }
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * RGB565 drawing kernels for PixelWriter.
+ * Strides are in pixels. On targets with the PIE vector extension the fills store 128 bits at a time,
+ * everything else is portable C so that resources/pixel_bench.c can run it on the host.
+ */
+
+/**
+ * @brief Set count pixels to color
+ */
+void pixel_fill(uint16_t *dst, uint16_t color, size_t count);
+
+/**
+ * @brief Set a width x height rectangle to color
+ */
+void pixel_fill_rect(uint16_t *dst, size_t stride, size_t width, size_t height, uint16_t color);
+
+/**
+ * @brief Draw color where a bit of a 1bpp bitmap is set, the other pixels are left as they are
+ *
+ * @param bits  Rows of 32-bit words, most significant bit first, each row starts on a new word
+ */
+void pixel_expand_1bpp(uint16_t *dst, size_t stride, const uint32_t *bits, size_t width, size_t height, uint16_t color);
+
+/**
+ * @brief Blend color over the destination with 8-bit coverage, 0 leaves the pixel and 255 replaces it
+ *
+ * Runs of empty and solid coverage are skipped and filled four pixels at a time, only the edges are blended.
+ */
+void pixel_blend_a8(uint16_t *dst, size_t stride, const uint8_t *coverage, size_t coverage_stride,
+                    size_t width, size_t height, uint16_t color);
+
+#ifdef __cplusplus
+}
+#endif
@@ -57,6 +57,58 @@ void _I2S_TDM_PCM_SHORT_SLOT_DEFAULT_CONFIG(i2s_tdm_slot_config_t *ptr, i2s_data
 void _I2S_TDM_PCM_LONG_SLOT_DEFAULT_CONFIG(i2s_tdm_slot_config_t *ptr, i2s_data_bit_width_t bits_per_sample, i2s_slot_mode_t mono_or_stereo, i2s_tdm_slot_mask_t mask) {
     *ptr = (i2s_tdm_slot_config_t)I2S_TDM_PCM_LONG_SLOT_DEFAULT_CONFIG(bits_per_sample, mono_or_stereo, mask);
 }
+
+/*
+ * I2S TX progress
+ * Counts the written bytes that the DMA has not sent yet, so that the player can tell what is audible now.
+ */
+typedef struct {
+    portMUX_TYPE lock;
+    uint32_t queued;
+} i2s_tx_progress_t;
+
+bool _i2s_tx_progress_on_sent(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx) {
+    i2s_tx_progress_t *progress = (i2s_tx_progress_t *)user_ctx;
+    portENTER_CRITICAL_ISR(&progress->lock);
+    // Silence sent by auto clear while nothing is queued is not counted
+    progress->queued -= event->size < progress->queued ? event->size : progress->queued;
+    portEXIT_CRITICAL_ISR(&progress->lock);
+    return false;
+}
+i2s_tx_progress_t *i2s_tx_progress_new(i2s_chan_handle_t tx) {
+    i2s_tx_progress_t *progress = (i2s_tx_progress_t *)calloc(1, sizeof(i2s_tx_progress_t));
+    if (progress == NULL) {
+        return NULL;
+    }
+    portMUX_INITIALIZE(&progress->lock);
+    // Callbacks can only be registered while the channel is stopped
+    i2s_event_callbacks_t callbacks = { .on_sent = _i2s_tx_progress_on_sent };
+    i2s_channel_disable(tx);
+    esp_err_t err = i2s_channel_register_event_callback(tx, &callbacks, progress);
+    i2s_channel_enable(tx);
+    if (err != ESP_OK) {
+        free(progress);
+        return NULL;
+    }
+    return progress;
+}
+void i2s_tx_progress_add(i2s_tx_progress_t *progress, uint32_t bytes) {
+    portENTER_CRITICAL(&progress->lock);
+    progress->queued += bytes;
+    portEXIT_CRITICAL(&progress->lock);
+}
+void i2s_tx_progress_reset(i2s_tx_progress_t *progress) {
+    portENTER_CRITICAL(&progress->lock);
+    progress->queued = 0;
+    portEXIT_CRITICAL(&progress->lock);
+}
+uint32_t i2s_tx_progress_queued(i2s_tx_progress_t *progress) {
+    portENTER_CRITICAL(&progress->lock);
+    uint32_t queued = progress->queued;
+    portEXIT_CRITICAL(&progress->lock);
+    return queued;
+}
+
 // SDMMC
 void _SDMMC_HOST_DEFAULT(sdmmc_host_t *ptr) {
     *ptr = (sdmmc_host_t)SDMMC_HOST_DEFAULT();
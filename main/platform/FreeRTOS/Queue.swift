@@ -21,6 +21,18 @@ class Queue<T>: Sequence {
         return res == pdPASS
     }
 
+    /// `woken` is set when a task of higher priority was unblocked, return it from the interrupt handler
+    @discardableResult
+    func sendFromISR(_ item: T, woken: inout Bool) -> Bool {
+        var item = item
+        var higherPriorityTaskWoken: BaseType_t = 0
+        let res = withUnsafePointer(to: &item) {
+            xQueueGenericSendFromISR(queue, $0, &higherPriorityTaskWoken, queueSEND_TO_BACK)
+        }
+        woken = woken || higherPriorityTaskWoken != 0
+        return res == pdPASS
+    }
+
     func receive(timeout: UInt32 = portMAX_DELAY) -> T? {
         withUnsafeTemporaryAllocation(of: T.self, capacity: 1) {
             let res = xQueueReceive(queue, $0.baseAddress, timeout)
@@ -32,6 +44,10 @@ class Queue<T>: Sequence {
         }
     }
 
+    var count: Int {
+        return Int(uxQueueMessagesWaiting(queue))
+    }
+
     struct Iterator: IteratorProtocol {
         private let queue: Queue<T>
         init(queue: Queue<T>) {
@@ -43,4 +43,13 @@ class Semaphore {
         let res = xQueueGiveFromISR(semaphore, &higherPriorityTaskWoken)
         return res == pdPASS
     }
+
+    /// `woken` is set when a task of higher priority was unblocked, return it from the interrupt handler
+    @discardableResult
+    func giveFromISR(woken: inout Bool) -> Bool {
+        var higherPriorityTaskWoken: BaseType_t = 0
+        let res = xQueueGiveFromISR(semaphore, &higherPriorityTaskWoken)
+        woken = woken || higherPriorityTaskWoken != 0
+        return res == pdPASS
+    }
 }
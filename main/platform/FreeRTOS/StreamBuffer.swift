@@ -0,0 +1,35 @@
+class StreamBuffer {
+    private let buffer: StreamBufferHandle_t
+    let capacity: Int
+
+    // Lock-free for one writer task and one reader task
+    init?(capacity: Int, triggerLevel: Int = 1, capability: Memory.Capability = .spiram) {
+        let buffer = xStreamBufferCreateWithCaps(capacity, triggerLevel, capability.rawValue)
+        if buffer == nil {
+            return nil
+        }
+        self.buffer = buffer!
+        self.capacity = capacity
+    }
+
+    deinit {
+        vStreamBufferDeleteWithCaps(buffer)
+    }
+
+    @discardableResult
+    func send(_ data: UnsafeRawBufferPointer, timeout: UInt32 = portMAX_DELAY) -> Int {
+        return xStreamBufferSend(buffer, data.baseAddress, data.count, timeout)
+    }
+
+    func receive(into data: UnsafeMutableRawBufferPointer, timeout: UInt32 = portMAX_DELAY) -> Int {
+        return xStreamBufferReceive(buffer, data.baseAddress, data.count, timeout)
+    }
+
+    var count: Int {
+        return xStreamBufferBytesAvailable(buffer)
+    }
+
+    var isEmpty: Bool {
+        return xStreamBufferIsEmpty(buffer) == pdTRUE
+    }
+}
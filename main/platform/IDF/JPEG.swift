@@ -71,6 +71,19 @@ extension IDF {
             return try Decoder<UInt16>(intrPriority: intrPriority, timeout: timeout, decodeConfig: decodeConfig)
         }
 
+        /// YUV420 in the layout the PPA reads, 12 bits per pixel
+        static func createDecoderYuv420(
+            intrPriority: Int32 = 0,
+            timeout: Int32 = 100,
+        ) throws(IDF.Error) -> Decoder<UInt8> {
+            let decodeConfig = jpeg_decode_cfg_t(
+                output_format: DecoderOutFormat.yuv420.value,
+                rgb_order: DecoderRGBElementOrder.rgb.value,
+                conv_std: DecoderRGBConversion.bt601.value
+            )
+            return try Decoder<UInt8>(intrPriority: intrPriority, timeout: timeout, decodeConfig: decodeConfig)
+        }
+
         class Decoder<E> {
             private let engine: jpeg_decoder_handle_t
             private var decodeConfig: jpeg_decode_cfg_t
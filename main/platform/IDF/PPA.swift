@@ -16,6 +16,18 @@ extension IDF {
             }
         }
 
+        enum ColorMode {
+            case rgb565
+            case yuv420
+
+            var value: ppa_srm_color_mode_t {
+                switch self {
+                case .rgb565: return PPA_SRM_COLOR_MODE_RGB565
+                case .yuv420: return PPA_SRM_COLOR_MODE_YUV420
+                }
+            }
+        }
+
         init(operType: Operation) throws(IDF.Error) {
             var client: ppa_client_handle_t?
             var config = ppa_client_config_t()
@@ -24,15 +36,23 @@ extension IDF {
             self.client = client!
         }
 
+        /// Scale and rotate into the output, returns the area that was written.
+        /// YUV420 input is converted to RGB565 in the same pass.
+        /// `inputPictureSize` is the size the input buffer is laid out with, when its rows are padded beyond `inputSize`.
+        @discardableResult
         func fitScreen(
-            inputBuffer: UnsafeMutableBufferPointer<UInt16>,
+            inputBuffer: UnsafeRawPointer,
             inputSize: Size,
+            inputPictureSize: Size? = nil,
+            inputColorMode: ColorMode = .rgb565,
             outputBuffer: UnsafeMutableBufferPointer<UInt16>,
             outputSize: Size,
-        ) throws(IDF.Error) {
-            let rotate =
+            allowRotation: Bool = true,
+        ) throws(IDF.Error) -> Rect {
+            let rotate = allowRotation && (
                 (inputSize.width > inputSize.height && outputSize.width < outputSize.height) ||
                 (inputSize.width < inputSize.height && outputSize.width > outputSize.height)
+            )
             let scale = min(
                 Float(rotate ? outputSize.height : outputSize.width) / Float(inputSize.width),
                 Float(rotate ? outputSize.width : outputSize.height) / Float(inputSize.height)
@@ -43,12 +63,18 @@ extension IDF {
             )
 
             var config = ppa_srm_oper_config_t()
-            config.in.buffer = UnsafeRawPointer(inputBuffer.baseAddress)
-            config.in.pic_w = UInt32(inputSize.width)
-            config.in.pic_h = UInt32(inputSize.height)
+            config.in.buffer = inputBuffer
+            let pictureSize = inputPictureSize ?? inputSize
+            config.in.pic_w = UInt32(pictureSize.width)
+            config.in.pic_h = UInt32(pictureSize.height)
             config.in.block_w = UInt32(inputSize.width)
             config.in.block_h = UInt32(inputSize.height)
-            config.in.srm_cm = PPA_SRM_COLOR_MODE_RGB565
+            config.in.srm_cm = inputColorMode.value
+            if inputColorMode == .yuv420 {
+                // Same conversion as the RGB565 decoder, JPEG samples use the full range
+                config.in.yuv_range = PPA_COLOR_RANGE_FULL
+                config.in.yuv_std = PPA_COLOR_CONV_STD_RGB_YUV_BT709
+            }
             config.out.buffer = UnsafeMutableRawPointer(outputBuffer.baseAddress)
             config.out.buffer_size = UInt32(outputBuffer.count * MemoryLayout<UInt16>.size)
             config.out.pic_w = UInt32(outputSize.width)
@@ -60,6 +86,102 @@ extension IDF {
             config.scale_x = scale
             config.scale_y = scale
             try IDF.Error.check(ppa_do_scale_rotate_mirror(client, &config))
+            return Rect(
+                origin: Point(x: Int(config.out.block_offset_x), y: Int(config.out.block_offset_y)),
+                size: outputFitSize
+            )
+        }
+
+        /// Copy a block of an RGB565 picture into a buffer of the block's size, without the CPU
+        func copy(
+            from inputBuffer: UnsafeRawPointer,
+            size: Size,
+            block: Rect,
+            into outputBuffer: UnsafeMutableRawBufferPointer
+        ) throws(IDF.Error) {
+            var config = ppa_srm_oper_config_t()
+            config.in.buffer = inputBuffer
+            config.in.pic_w = UInt32(size.width)
+            config.in.pic_h = UInt32(size.height)
+            config.in.block_w = UInt32(block.width)
+            config.in.block_h = UInt32(block.height)
+            config.in.block_offset_x = UInt32(block.minX)
+            config.in.block_offset_y = UInt32(block.minY)
+            config.in.srm_cm = PPA_SRM_COLOR_MODE_RGB565
+            config.out.buffer = outputBuffer.baseAddress
+            config.out.buffer_size = UInt32(outputBuffer.count)
+            config.out.pic_w = UInt32(block.width)
+            config.out.pic_h = UInt32(block.height)
+            config.out.srm_cm = PPA_SRM_COLOR_MODE_RGB565
+            config.rotation_angle = PPA_SRM_ROTATION_ANGLE_0
+            config.scale_x = 1
+            config.scale_y = 1
+            try IDF.Error.check(ppa_do_scale_rotate_mirror(client, &config))
+        }
+
+        /// Blend an 8-bit alpha mask drawn in one colour over a block of an RGB565 picture, in place
+        func blend(
+            mask: UnsafeRawPointer,
+            maskSize: Size,
+            color: UInt16,
+            into buffer: UnsafeMutableBufferPointer<UInt16>,
+            size: Size,
+            at point: Point
+        ) throws(IDF.Error) {
+            var config = blendConfig(foreground: mask, foregroundSize: maskSize, into: buffer, size: size, at: point)
+            config.in_fg.blend_cm = PPA_BLEND_COLOR_MODE_A8
+            // A8 carries no colour, every pixel of the mask takes the fixed one
+            let r = UInt32(color >> 11), g = UInt32(color >> 5 & 0x3F), b = UInt32(color & 0x1F)
+            config.fg_fix_rgb_val.val = (r << 3 | r >> 2) << 16 | (g << 2 | g >> 4) << 8 | (b << 3 | b >> 2)
+            try IDF.Error.check(ppa_do_blend(client, &config))
+        }
+
+        /// Blend an RGB565 layer with a constant opacity over a block of an RGB565 picture, in place
+        func blend(
+            layer: UnsafeRawPointer,
+            layerSize: Size,
+            alpha: UInt8,
+            into buffer: UnsafeMutableBufferPointer<UInt16>,
+            size: Size,
+            at point: Point
+        ) throws(IDF.Error) {
+            var config = blendConfig(foreground: layer, foregroundSize: layerSize, into: buffer, size: size, at: point)
+            config.in_fg.blend_cm = PPA_BLEND_COLOR_MODE_RGB565
+            config.fg_alpha_update_mode = PPA_ALPHA_FIX_VALUE
+            config.fg_alpha_fix_val = UInt32(alpha)
+            try IDF.Error.check(ppa_do_blend(client, &config))
+        }
+
+        private func blendConfig(
+            foreground: UnsafeRawPointer,
+            foregroundSize: Size,
+            into buffer: UnsafeMutableBufferPointer<UInt16>,
+            size: Size,
+            at point: Point
+        ) -> ppa_blend_oper_config_t {
+            var config = ppa_blend_oper_config_t()
+            config.in_bg.buffer = UnsafeRawPointer(buffer.baseAddress)
+            config.in_bg.pic_w = UInt32(size.width)
+            config.in_bg.pic_h = UInt32(size.height)
+            config.in_bg.block_w = UInt32(foregroundSize.width)
+            config.in_bg.block_h = UInt32(foregroundSize.height)
+            config.in_bg.block_offset_x = UInt32(point.x)
+            config.in_bg.block_offset_y = UInt32(point.y)
+            config.in_bg.blend_cm = PPA_BLEND_COLOR_MODE_RGB565
+            config.in_fg.buffer = foreground
+            config.in_fg.pic_w = UInt32(foregroundSize.width)
+            config.in_fg.pic_h = UInt32(foregroundSize.height)
+            config.in_fg.block_w = UInt32(foregroundSize.width)
+            config.in_fg.block_h = UInt32(foregroundSize.height)
+            config.out.buffer = UnsafeMutableRawPointer(buffer.baseAddress)
+            config.out.buffer_size = UInt32(buffer.count * MemoryLayout<UInt16>.size)
+            config.out.pic_w = UInt32(size.width)
+            config.out.pic_h = UInt32(size.height)
+            config.out.block_offset_x = UInt32(point.x)
+            config.out.block_offset_y = UInt32(point.y)
+            config.out.blend_cm = PPA_BLEND_COLOR_MODE_RGB565
+            config.mode = PPA_TRANS_MODE_BLOCKING
+            return config
         }
     }
 }
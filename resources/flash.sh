@@ -1,3 +1,9 @@
 #!/bin/sh
 font_offset=$((4 * 1024 * 1024)) # font partition offset
-esptool.py --chip esp32p4 write_flash $font_offset EmbeddedJP/EmbeddedJP.ttf
+atlas_offset=$((6 * 1024 * 1024)) # font_atlas partition offset
+
+# Prebake the UI glyphs, pass -d <directory> or -c <text file> to add the kanji of your file names
+cc -O2 -o font_atlas font_atlas.c -lm || exit 1
+./font_atlas "$@" EmbeddedJP/EmbeddedJP.ttf EmbeddedJP/EmbeddedJP.atlas || exit 1
+
+esptool.py --chip esp32p4 write_flash $font_offset EmbeddedJP/EmbeddedJP.ttf $atlas_offset EmbeddedJP/EmbeddedJP.atlas
@@ -0,0 +1,267 @@
+/*
+ * Prebakes the glyphs of the UI into a font atlas partition, the player draws them without rasterising.
+ *
+ *   cc -O2 -o font_atlas font_atlas.c -lm
+ *   ./font_atlas EmbeddedJP/EmbeddedJP.ttf EmbeddedJP/EmbeddedJP.atlas [-s 26,40,48,54,60,72] [-c chars.txt] [-d /media/usb]
+ *
+ * Every glyph of the font outside the CJK ideographs is baked: ASCII, kana and the symbols.
+ * Kanji are added from UTF-8 text files (-c) and from the names of the files and directories under a directory (-d),
+ * the ones left out are rasterised on the device as before.
+ *
+ * Layout, little endian:
+ *   header   u32 magic 'FATL', u16 version, u16 reserved, u32 glyph count,
+ *            u32 checksumAdjustment of the 'head' table of the font it was made from
+ *   index    u32 key (code point << 8 | pixel size), u32 bitmap offset, u16 width, u16 height, i16 x, i16 y
+ *            sorted by key
+ *   bitmaps  8-bit coverage, width * height bytes each, as made by stbtt_MakeCodepointBitmap
+ */
+
+#define STB_TRUETYPE_IMPLEMENTATION
+#include "../main/graphics/thirdparty/stb_truetype.h"
+
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define ATLAS_MAGIC     0x4C544146  /* 'FATL' */
+#define ATLAS_VERSION   1
+#define PARTITION_SIZE  (4 * 1024 * 1024)   /* font_atlas in partitions.csv */
+#define MAX_SIZES       16
+
+static uint8_t wanted[0x110000];
+
+typedef struct {
+    uint32_t key;
+    uint32_t offset;
+    uint16_t width;
+    uint16_t height;
+    int16_t x;
+    int16_t y;
+} atlas_entry_t;
+
+static void add_utf8(const char *text)
+{
+    const uint8_t *p = (const uint8_t *)text;
+    while (*p) {
+        uint32_t cp;
+        int extra;
+        if (*p < 0x80) {
+            cp = *p;
+            extra = 0;
+        } else if ((*p & 0xE0) == 0xC0) {
+            cp = *p & 0x1F;
+            extra = 1;
+        } else if ((*p & 0xF0) == 0xE0) {
+            cp = *p & 0x0F;
+            extra = 2;
+        } else if ((*p & 0xF8) == 0xF0) {
+            cp = *p & 0x07;
+            extra = 3;
+        } else {
+            p++;
+            continue;
+        }
+        p++;
+        for (; extra > 0 && (*p & 0xC0) == 0x80; extra--, p++) {
+            cp = (cp << 6) | (*p & 0x3F);
+        }
+        if (extra == 0 && cp < sizeof(wanted)) {
+            wanted[cp] = 1;
+        }
+    }
+}
+
+static int add_file(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        add_utf8(line);
+    }
+    fclose(file);
+    return 0;
+}
+
+static int add_names(const char *path)
+{
+    DIR *dir = opendir(path);
+    if (!dir) {
+        perror(path);
+        return -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        add_utf8(entry->d_name);
+        if (entry->d_type == DT_DIR) {
+            char child[4096];
+            snprintf(child, sizeof(child), "%s/%s", path, entry->d_name);
+            add_names(child);
+        }
+    }
+    closedir(dir);
+    return 0;
+}
+
+static uint8_t *read_font(const char *path, long *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = malloc(*size);
+    if (data && fread(data, 1, *size, file) != (size_t)*size) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+    return data;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+    put16(p, v);
+    put16(p + 2, v >> 16);
+}
+
+int main(int argc, char **argv)
+{
+    int sizes[MAX_SIZES] = {26, 40, 48, 54, 60, 72};
+    int size_count = 6;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:c:d:")) != -1) {
+        switch (opt) {
+        case 's':
+            size_count = 0;
+            for (char *s = strtok(optarg, ","); s && size_count < MAX_SIZES; s = strtok(NULL, ",")) {
+                sizes[size_count++] = atoi(s);
+            }
+            break;
+        case 'c':
+            if (add_file(optarg) != 0) {
+                return 1;
+            }
+            break;
+        case 'd':
+            if (add_names(optarg) != 0) {
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, "usage: %s font.ttf out.atlas [-s sizes] [-c chars.txt] [-d dir]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        fprintf(stderr, "usage: %s font.ttf out.atlas [-s sizes] [-c chars.txt] [-d dir]\n", argv[0]);
+        return 1;
+    }
+
+    long font_size;
+    uint8_t *font_data = read_font(argv[optind], &font_size);
+    stbtt_fontinfo font;
+    if (!font_data || !stbtt_InitFont(&font, font_data, stbtt_GetFontOffsetForIndex(font_data, 0))) {
+        fprintf(stderr, "%s: not a TrueType font\n", argv[optind]);
+        return 1;
+    }
+    for (uint32_t cp = 0x20; cp < 0x10000; cp++) {
+        if (cp < 0x3400 || (cp >= 0xA000 && cp < 0xF900) || cp >= 0xFB00) {
+            wanted[cp] = 1;
+        }
+    }
+
+    /* Keys are sorted by code point first, the index is written in that order */
+    size_t capacity = 4096, count = 0, bitmap_bytes = 0;
+    atlas_entry_t *entries = malloc(capacity * sizeof(atlas_entry_t));
+    uint8_t **bitmaps = malloc(capacity * sizeof(uint8_t *));
+    for (uint32_t cp = 0; cp < sizeof(wanted); cp++) {
+        if (!wanted[cp] || stbtt_FindGlyphIndex(&font, cp) == 0) {
+            continue;
+        }
+        for (int i = 0; i < size_count; i++) {
+            float scale = stbtt_ScaleForPixelHeight(&font, sizes[i]);
+            int x0, y0, x1, y1;
+            stbtt_GetCodepointBitmapBox(&font, cp, scale, scale, &x0, &y0, &x1, &y1);
+            if (x1 <= x0 || y1 <= y0) {
+                continue;
+            }
+            if (count == capacity) {
+                capacity *= 2;
+                entries = realloc(entries, capacity * sizeof(atlas_entry_t));
+                bitmaps = realloc(bitmaps, capacity * sizeof(uint8_t *));
+            }
+            atlas_entry_t *entry = &entries[count];
+            entry->key = cp << 8 | sizes[i];
+            entry->offset = bitmap_bytes;
+            entry->width = x1 - x0;
+            entry->height = y1 - y0;
+            entry->x = x0;
+            entry->y = y0;
+            bitmaps[count] = malloc(entry->width * entry->height);
+            stbtt_MakeCodepointBitmap(&font, bitmaps[count], entry->width, entry->height, entry->width, scale, scale, cp);
+            bitmap_bytes += entry->width * entry->height;
+            count++;
+        }
+    }
+    /* Sizes were added in the order given, sort them within each code point */
+    for (size_t i = 1; i < count; i++) {
+        for (size_t j = i; j > 0 && entries[j - 1].key > entries[j].key; j--) {
+            atlas_entry_t entry = entries[j];
+            entries[j] = entries[j - 1];
+            entries[j - 1] = entry;
+            uint8_t *bitmap = bitmaps[j];
+            bitmaps[j] = bitmaps[j - 1];
+            bitmaps[j - 1] = bitmap;
+        }
+    }
+
+    size_t header_bytes = 16 + count * 16;
+    size_t total = header_bytes + bitmap_bytes;
+    if (total > PARTITION_SIZE) {
+        fprintf(stderr, "atlas is %zu bytes, the partition holds %d: use fewer sizes or characters\n", total, PARTITION_SIZE);
+        return 1;
+    }
+    uint8_t *atlas = calloc(1, total);
+    put32(atlas, ATLAS_MAGIC);
+    put16(atlas + 4, ATLAS_VERSION);
+    put32(atlas + 8, count);
+    put32(atlas + 12, ttUSHORT(font_data + font.head + 8) << 16 | ttUSHORT(font_data + font.head + 10));
+    for (size_t i = 0; i < count; i++) {
+        uint8_t *p = atlas + 16 + i * 16;
+        put32(p, entries[i].key);
+        put32(p + 4, header_bytes + entries[i].offset);
+        put16(p + 8, entries[i].width);
+        put16(p + 10, entries[i].height);
+        put16(p + 12, entries[i].x);
+        put16(p + 14, entries[i].y);
+        memcpy(atlas + header_bytes + entries[i].offset, bitmaps[i], entries[i].width * entries[i].height);
+    }
+
+    FILE *out = fopen(argv[optind + 1], "wb");
+    if (!out || fwrite(atlas, 1, total, out) != total) {
+        perror(argv[optind + 1]);
+        return 1;
+    }
+    fclose(out);
+    printf("%zu glyphs in %d sizes, %zu bytes\n", count, size_count, total);
+    return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * Host benchmark of main/graphics/pixel_kernels.c against the per-pixel loops PixelWriter used before,
+ * written here in C with the bounds checks Swift adds to buffer subscripts.
+ *
+ *   cc -O2 -o pixel_bench pixel_bench.c -lm && ./pixel_bench
+ *
+ * The host build runs the portable paths, the PIE fills only exist on the ESP32-P4.
+ */
+
+#include "../main/graphics/pixel_kernels.c"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WIDTH   720
+#define HEIGHT  1280
+#define ROUNDS  50
+
+static uint16_t screen[WIDTH * HEIGHT];
+static uint16_t expected[WIDTH * HEIGHT];
+
+static void check(size_t index, size_t count)
+{
+    if (index >= count) {
+        abort();
+    }
+}
+
+/* PixelWriter.fillRect */
+static void loop_fill_rect(uint16_t *buffer, size_t x0, size_t y0, size_t width, size_t height, uint16_t color)
+{
+    for (size_t y = y0; y < y0 + height; y++) {
+        for (size_t x = x0; x < x0 + width; x++) {
+            check(y * WIDTH + x, WIDTH * HEIGHT);
+            buffer[y * WIDTH + x] = color;
+        }
+    }
+}
+
+/* PixelWriter.drawBitmap */
+static void loop_expand_1bpp(uint16_t *buffer, size_t x0, size_t y0, const uint32_t *bits, size_t width, size_t height, uint16_t color)
+{
+    size_t words = (width + 31) / 32;
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            check(y * words + x / 32, words * height);
+            if (bits[y * words + x / 32] & (1u << (31 - x % 32))) {
+                check((y0 + y) * WIDTH + x0 + x, WIDTH * HEIGHT);
+                buffer[(y0 + y) * WIDTH + x0 + x] = color;
+            }
+        }
+    }
+}
+
+/* PixelWriter.drawText before antialiasing, any coverage wrote the solid colour */
+static void loop_threshold(uint16_t *buffer, size_t x0, size_t y0, const uint8_t *coverage, size_t width, size_t height, uint16_t color)
+{
+    for (size_t y = 0; y < height; y++) {
+        for (size_t x = 0; x < width; x++) {
+            if (coverage[y * width + x] > 0) {
+                check((y0 + y) * WIDTH + x0 + x, WIDTH * HEIGHT);
+                buffer[(y0 + y) * WIDTH + x0 + x] = color;
+            }
+        }
+    }
+}
+
+/* Reference blend with full precision */
+static uint16_t blend_reference(uint16_t bg, uint16_t fg, uint8_t a)
+{
+    int r = ((fg >> 11) * a + (bg >> 11) * (255 - a) + 127) / 255;
+    int g = (((fg >> 5) & 63) * a + ((bg >> 5) & 63) * (255 - a) + 127) / 255;
+    int b = ((fg & 31) * a + (bg & 31) * (255 - a) + 127) / 255;
+    return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define BENCH(name, pixels, body) do { \
+        double start = now(); \
+        for (int round = 0; round < ROUNDS; round++) { \
+            body; \
+            __asm__ volatile("" ::: "memory"); \
+        } \
+        printf("  %-10s %7.3f ns/pixel\n", name, (now() - start) * 1e9 / ((double)(pixels) * ROUNDS)); \
+    } while (0)
+
+int main(void)
+{
+    int failures = 0;
+
+    printf("clear %dx%d\n", WIDTH, HEIGHT);
+    BENCH("loop", WIDTH * HEIGHT, loop_fill_rect(expected, 0, 0, WIDTH, HEIGHT, 0xFFFF - round));
+    BENCH("kernel", WIDTH * HEIGHT, pixel_fill(screen, 0xFFFF - round, WIDTH * HEIGHT));
+    failures += memcmp(screen, expected, sizeof(screen)) != 0;
+
+    printf("fill rect 641x97 at odd x\n");
+    BENCH("loop", 641 * 97, loop_fill_rect(expected, 37, 100, 641, 97, 0x1234 + round));
+    BENCH("kernel", 641 * 97, pixel_fill_rect(screen + 100 * WIDTH + 37, WIDTH, 641, 97, 0x1234 + round));
+    failures += memcmp(screen, expected, sizeof(screen)) != 0;
+
+    /* Icon like bitmap: a ring, solid words in the middle rows */
+    enum { ICON = 76, WORDS = (ICON + 31) / 32 };
+    static uint32_t icon[ICON * WORDS];
+    for (int y = 0; y < ICON; y++) {
+        for (int x = 0; x < ICON; x++) {
+            int dx = x - ICON / 2, dy = y - ICON / 2;
+            if (dx * dx + dy * dy < (ICON / 2) * (ICON / 2) && dx * dx + dy * dy > (ICON / 4) * (ICON / 4)) {
+                icon[y * WORDS + x / 32] |= 1u << (31 - x % 32);
+            }
+        }
+    }
+    printf("1bpp icon %dx%d\n", ICON, ICON);
+    BENCH("loop", ICON * ICON, loop_expand_1bpp(expected, 50, 300, icon, ICON, ICON, 0xF800));
+    BENCH("kernel", ICON * ICON, pixel_expand_1bpp(screen + 300 * WIDTH + 50, WIDTH, icon, ICON, ICON, 0xF800));
+    failures += memcmp(screen, expected, sizeof(screen)) != 0;
+
+    /* Glyph like coverage: a ring, empty and solid inside with antialiased edges */
+    enum { GLYPH = 60 };
+    static uint8_t coverage[GLYPH * GLYPH];
+    for (int y = 0; y < GLYPH; y++) {
+        for (int x = 0; x < GLYPH; x++) {
+            double d = sqrt((x - GLYPH / 2.0) * (x - GLYPH / 2.0) + (y - GLYPH / 2.0) * (y - GLYPH / 2.0));
+            double edge = fmin(d - GLYPH / 4.0, GLYPH / 2.0 - d);
+            coverage[y * GLYPH + x] = edge <= 0 ? 0 : edge >= 1 ? 255 : (uint8_t)(edge * 255);
+        }
+    }
+    printf("glyph %dx%d\n", GLYPH, GLYPH);
+    BENCH("loop", GLYPH * GLYPH, loop_threshold(expected, 100, 500, coverage, GLYPH, GLYPH, 0x07E0));
+    BENCH("blend", GLYPH * GLYPH, pixel_blend_a8(screen + 500 * WIDTH + 100, WIDTH, coverage, GLYPH, GLYPH, GLYPH, 0x07E0));
+    int worst = 0;
+    for (int bg = 0; bg < 0x10000; bg += 7) {
+        for (int a = 0; a < 256; a += 5) {
+            uint16_t pixel = bg;
+            uint8_t alpha = a;
+            pixel_blend_a8(&pixel, 1, &alpha, 1, 1, 1, 0xA5F3);
+            uint16_t want = blend_reference(bg, 0xA5F3, a);
+            int diff = abs((pixel >> 11) - (want >> 11));
+            diff = diff > abs(((pixel >> 5) & 63) - ((want >> 5) & 63)) ? diff : abs(((pixel >> 5) & 63) - ((want >> 5) & 63));
+            diff = diff > abs((pixel & 31) - (want & 31)) ? diff : abs((pixel & 31) - (want & 31));
+            worst = diff > worst ? diff : worst;
+        }
+    }
+    /* Alpha is quantised to 5 bits, green has 6 */
+    printf("  largest channel error %d\n", worst);
+    failures += worst > 2;
+
+    printf(failures ? "FAILED\n" : "OK\n");
+    return failures != 0;
+}